@@ -1,311 +1,4606 @@
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
 #include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+#include <new>
 #include <vector>
 #include <algorithm>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <cmath>
+#include <numeric>
+#include <future>
+#include <random>
 
 #include <glm/glm.hpp>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <png.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <unistd.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include "shaderdude_core.hpp"
+
 using namespace std::string_literals;
 
-struct texture 
+// Heap allocations made by the current thread - the frame loop should make none
+thread_local uint64_t allocation_count = 0;
+
+void *operator new(std::size_t size)
+{
+	allocation_count++;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+struct render_target
 {
-	std::string filename;
+	GLuint fbo;
 	GLuint tex;
-	uint8_t *data;
+	int width;
+	int height;
+	GLenum format;
+	
+	render_target(const render_target&) = delete;
+	render_target &operator=(const render_target&) = delete;
+	
+	render_target(int w, int h, GLenum f = GL_RGBA8) :
+		width(w),
+		height(h),
+		format(f)
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+		glTextureStorage2D(tex, 1, format, width, height);
+		glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		
+		glCreateFramebuffers(1, &fbo);
+		glNamedFramebufferTexture(fbo, GL_COLOR_ATTACHMENT0, tex, 0);
+		if (glCheckNamedFramebufferStatus(fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			glDeleteFramebuffers(1, &fbo);
+			glDeleteTextures(1, &tex);
+			throw std::runtime_error("incomplete framebuffer");
+		}
+	}
+	
+	~render_target()
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &tex);
+	}
+	
+	void bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, width, height);
+	}
+};
+
+/*
+	Writes an 8-bit RGB or RGBA PNG file row by row, top to bottom,
+	so the whole image never has to be in memory at once. Nothing is
+	written for sure before finish(), and an unfinished file is removed.
+*/
+struct png_writer
+{
+	std::string path;
+	FILE *file;
+	png_structp png;
+	png_infop info;
 	int width;
 	int height;
 	int channels;
+	int rows_written = 0;
+	
+	png_writer(const png_writer&) = delete;
+	png_writer &operator=(const png_writer&) = delete;
+	
+	png_writer(const std::string &path, int w, int h, int c) :
+		path(path),
+		width(w),
+		height(h),
+		channels(c)
+	{
+		file = std::fopen(path.c_str(), "wb");
+		if (!file)
+			throw std::runtime_error("could not open '"s + path + "' for writing"s);
+		
+		png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+		info = png ? png_create_info_struct(png) : nullptr;
+		if (!info || setjmp(png_jmpbuf(png)))
+		{
+			png_destroy_write_struct(&png, &info);
+			std::fclose(file);
+			throw std::runtime_error("could not write PNG header to '"s + path + "'"s);
+		}
+		
+		png_init_io(png, file);
+		png_set_IHDR(png, info, width, height, 8, channels == 4 ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+		png_write_info(png, info);
+	}
+	
+	// Rows are tightly packed
+	void write_rows(const uint8_t *data, int count)
+	{
+		if (setjmp(png_jmpbuf(png)))
+			throw std::runtime_error("writing '"s + path + "' failed"s);
+		
+		for (int i = 0; i < count; i++)
+			png_write_row(png, data + i * width * channels);
+		rows_written += count;
+	}
 	
-	texture(const texture&) = delete;
-	texture &operator=(const texture&) = delete;
+	// Writes the end of the file and closes it, all rows must have been written
+	void finish()
+	{
+		if (rows_written != height)
+			throw std::runtime_error("'"s + path + "' is missing rows"s);
+		if (setjmp(png_jmpbuf(png)))
+			throw std::runtime_error("writing '"s + path + "' failed"s);
+		
+		png_write_end(png, nullptr);
+		png_destroy_write_struct(&png, &info);
+		bool ok = !std::fflush(file) && !std::ferror(file);
+		ok = !std::fclose(file) && ok;
+		file = nullptr;
+		if (!ok)
+		{
+			std::remove(path.c_str());
+			throw std::runtime_error("writing '"s + path + "' failed"s);
+		}
+	}
 	
-	texture(texture &&src) :
-		filename(std::move(src.filename)),
-		tex(src.tex),
-		data(src.data),
-		width(src.width),
-		height(src.height),
-		channels(src.channels)
+	~png_writer()
 	{
-		src.tex = 0;
-		src.data = nullptr;
+		if (!file) return;
+		png_destroy_write_struct(&png, &info);
+		std::fclose(file);
+		std::remove(path.c_str());
 	}
+};
+
+/*
+	Progress of a headless render, saved every now and then so a killed
+	job can continue where it left off. Besides the position it keeps
+	a key telling which shader and settings it belongs to. Frames only
+	depend on their number, so nothing else has to be carried over.
+*/
+struct checkpoint
+{
+	uint64_t key = 0;
+	long next = 0;
+	uint64_t stream_size = 0;
+	std::map<long, uint64_t> hashes;
 	
-	explicit texture(const std::string &path)
+	// Written under a temporary name, synced and renamed, so there always is one complete checkpoint
+	void write(const std::string &path) const
 	{
-		data = stbi_load(path.c_str(), &width, &height, &channels, 0);
-		if (!data)
-			throw std::runtime_error("failed to load image '"s + path + "'"s);
+		std::string temp_path = path + ".tmp"s;
+		FILE *f = std::fopen(temp_path.c_str(), "wb");
+		if (!f)
+			throw std::runtime_error("could not open '"s + temp_path + "' for writing"s);
 		
-		// Reorder
-		int row_size = width * channels;
-		for (int y = 0; y < height / 2; y++)
-			std::swap_ranges(data + y * row_size, data + (y + 1) * row_size, data + (height - 1 - y) * row_size);
+		auto put = [&](const void *data, size_t size){ std::fwrite(data, 1, size, f); };
+		auto put_value = [&](uint64_t v){ put(&v, sizeof(v)); };
 		
-		GLenum data_format;
-		if (channels == 1) data_format = GL_RED;
-		else if (channels == 2) data_format = GL_RG;
-		else if (channels == 3) data_format = GL_RGB;
-		else data_format = GL_RGBA;
+		put("SDCKPT2\n", 8);
+		put_value(key);
+		put_value(next);
+		put_value(stream_size);
+		put_value(hashes.size());
+		for (const auto &[frame, hash] : hashes)
+		{
+			put_value(frame);
+			put_value(hash);
+		}
 		
-		glCreateTextures(GL_TEXTURE_2D, 1, &tex);
-		glTextureStorage2D(tex, 1, GL_RGBA8, width, height);
-		glTextureSubImage2D(tex, 0, 0, 0, width, height, data_format, GL_UNSIGNED_BYTE, data);
-		glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		bool ok = !std::fflush(f) && !std::ferror(f) && !fsync(fileno(f));
+		ok = !std::fclose(f) && ok;
+		if (!ok || std::rename(temp_path.c_str(), path.c_str()))
+			throw std::runtime_error("could not write checkpoint '"s + path + "'"s);
+	}
+	
+	// False if there is no checkpoint yet
+	bool read(const std::string &path)
+	{
+		FILE *f = std::fopen(path.c_str(), "rb");
+		if (!f) return false;
+		
+		bool ok = true;
+		auto get = [&](void *data, size_t size){ ok = ok && std::fread(data, 1, size, f) == size; };
+		auto get_value = [&]{ uint64_t v = 0; get(&v, sizeof(v)); return v; };
+		
+		char magic[8] = {};
+		get(magic, 8);
+		ok = ok && !std::memcmp(magic, "SDCKPT2\n", 8);
+		key = get_value();
+		next = get_value();
+		stream_size = get_value();
+		for (uint64_t n = get_value(); ok && n > 0; n--)
+		{
+			long frame = get_value();
+			hashes[frame] = get_value();
+		}
+		
+		std::fclose(f);
+		if (!ok)
+			throw std::runtime_error("checkpoint '"s + path + "' is corrupted"s);
+		return true;
+	}
+};
+
+bool gui_visible = true;
+
+GLuint create_vertex_shader()
+{
+	static const std::string source = 
+	"#version 430 core\n"
+
+	"out VS_OUT"
+	"{"
+	"	vec2 uv;"
+	"} vs_out;"
+
+	"const vec2 vertices[6] = vec2[6]("
+	"	vec2(-1, -1),"
+	"	vec2(1, -1),"
+	"	vec2(-1, 1),"
+	"	vec2(-1, 1),"
+	"	vec2(1, -1),"
+	"	vec2(1, 1)"
+	");"
+
+	"void main()"
+	"{"
+	"	vec2 vertex = vertices[gl_VertexID];"
+	"	gl_Position = vec4(vertex.xy, 0, 1);"
+	"	vs_out.uv = vertex * 0.5 + 0.5;"
+	"}";
+	
+	return create_shader(GL_VERTEX_SHADER, source);
+}
+
+GLuint link_program(GLuint vsh, GLuint fsh)
+{
+	trace_scope scope("link program");
+	GLuint prog = glCreateProgram();
+	glAttachShader(prog, vsh);
+	glAttachShader(prog, fsh);
+	glLinkProgram(prog);
+	glDeleteShader(vsh);
+	glDeleteShader(fsh);
+	
+	// A program that failed to link must never be used - with a no-error context that's undefined
+	GLint result, length;
+	glGetProgramiv(prog, GL_LINK_STATUS, &result);
+	if (result == GL_FALSE)
+	{
+		glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &length);
+		std::string log(std::max(length, 1), '\0');
+		glGetProgramInfoLog(prog, log.size(), NULL, &log[0]);
+		log.resize(std::strlen(log.c_str()));
+		glDeleteProgram(prog);
+		throw std::runtime_error("Program linking failed:\n"s + log + "\n"s);
+	}
+	
+	return prog;
+}
+
+/*
+	When each step of getting a saved edit on screen was done, on the
+	get_time() clock. The save time comes from the file's modification
+	time, so it's only as precise as the file system.
+*/
+struct reload_timing
+{
+	double saved = 0.0;
+	double detected = 0.0;
+	double read = 0.0;
+	double compiled = 0.0;
+	double linked = 0.0;
+	double drawn = 0.0;
+	double swapped = 0.0;
+	
+	double total() const
+	{
+		return swapped - (saved > 0.0 ? saved : detected);
+	}
+	
+	// One line with the time of each step in ms
+	int format(char *buf, size_t size) const
+	{
+		return std::snprintf(buf, size, "%.1f ms (detected %.1f, read %.1f, compiled %.1f, linked %.1f, drawn %.1f, swapped %.1f)",
+			total() * 1000.0, saved > 0.0 ? (detected - saved) * 1000.0 : 0.0, (read - detected) * 1000.0, (compiled - read) * 1000.0,
+			(linked - compiled) * 1000.0, (drawn - linked) * 1000.0, (swapped - drawn) * 1000.0);
+	}
+};
+
+std::unique_ptr<shader_program> make_program(const std::string &path, int texture_count, reload_timing *timing = nullptr)
+{
+	trace_scope scope("make_program");
+	GLuint vsh = 0, fsh = 0;
+	std::string source;
+	
+	try
+	{
+		source = compose_fragment_source(path, texture_count);
+		if (timing) timing->read = get_time();
+		
+		// Both stages count as compiling
+		vsh = create_vertex_shader();
+		fsh = create_shader(GL_FRAGMENT_SHADER, source);
+		if (timing) timing->compiled = get_time();
+	}
+	catch (...)
+	{
+		glDeleteShader(vsh);
+		glDeleteShader(fsh);
+		std::rethrow_exception(std::current_exception());
+	}
+	
+	// Introspecting the uniforms waits for the link to finish
+	auto program = std::make_unique<shader_program>(link_program(vsh, fsh));
+	program->source = std::move(source);
+	if (timing) timing->linked = get_time();
+	return program;
+}
+	
+// Internal fullscreen passes share the vertex shader with the user shader
+std::unique_ptr<shader_program> make_builtin_program(const std::string &fragment_source)
+{
+	GLuint vsh = create_vertex_shader(), fsh = 0;
+	
+	try
+	{
+		fsh = create_shader(GL_FRAGMENT_SHADER, fragment_source);
+	}
+	catch (...)
+	{
+		glDeleteShader(vsh);
+		std::rethrow_exception(std::current_exception());
+	}
+	
+	return std::make_unique<shader_program>(link_program(vsh, fsh));
+}
+
+std::unique_ptr<shader_program> make_present_program()
+{
+	static const std::string source = 
+	"#version 430 core\n"
+	
+	"in VS_OUT"
+	"{"
+	"	vec2 uv;"
+	"} vs_out;"
+	
+	"layout (binding = 0) uniform sampler2D image;"
+	"out vec4 f_color;"
+	
+	"void main()"
+	"{"
+	"	f_color = texture(image, vs_out.uv);"
+	"}";
+	
+	return make_builtin_program(source);
+}
+
+// Draws the image over the whole default framebuffer
+void present(const render_target &image, const shader_program &prog, int width, int height)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	glUseProgram(prog.id);
+	glBindTextureUnit(0, image.tex);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+// Which of the per-frame inputs are live in a program
+struct shader_inputs
+{
+	bool time = false;
+	bool frame = false;
+	bool mouse = false;
+	
+	shader_inputs() = default;
+	
+	explicit shader_inputs(const shader_program &program) :
+		time(referenced(program, "iTime")),
+		frame(referenced(program, "iFrame")),
+		mouse(referenced(program, "iMouse"))
+	{}
+	
+	static bool referenced(const shader_program &program, const std::string &name)
+	{
+		auto it = program.uniforms.find(name);
+		if (it == program.uniforms.end())
+			return false;
+		if (it->second.location >= 0)
+			return true;
+		
+		// Members of sd_input stay active whether they're read or not - and
+		// drivers differ in what GL_REFERENCED_BY_FRAGMENT_SHADER says about
+		// them - so look for uses in the source instead. Besides the one
+		// declaration in the prefix, any mention counts.
+		return count_identifier(program.source, name) > 1;
+	}
+	
+	// Whole-word occurrences outside comments
+	static int count_identifier(const std::string &source, const std::string &name)
+	{
+		auto is_ident = [](char c){ return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+		int count = 0;
+		for (size_t i = 0; i < source.size();)
+		{
+			if (source.compare(i, 2, "//") == 0)
+				i = std::min(source.find('\n', i), source.size());
+			else if (source.compare(i, 2, "/*") == 0)
+				i = std::min(source.find("*/", i + 2), source.size() - 2) + 2;
+			else if (is_ident(source[i]))
+			{
+				size_t end = i;
+				while (end < source.size() && is_ident(source[end]))
+					end++;
+				if (source.compare(i, end - i, name) == 0)
+					count++;
+				i = end;
+			}
+			else
+				i++;
+		}
+		return count;
+	}
+	
+	bool animated() const
+	{
+		return time || frame;
+	}
+};
+
+enum class interleave_mode
+{
+	off,
+	checkerboard,
+	quarter,
+};
+
+/*
+	Splits the shader pass into a grid of scissored tiles with a
+	GL_TIMESTAMP between each two, and keeps a moving average of every
+	tile's cost. The grid covers the whole target, so it lines up with
+	the output whatever the interleaving or preview resolution.
+*/
+struct cost_heatmap
+{
+	static constexpr int ring_size = 3;
+	
+	int columns = 0;
+	int rows = 0;
+	std::vector<GLuint> queries[ring_size];
+	bool pending[ring_size] = {};
+	int slot = 0;
+	
+	// Per-tile cost in ms, row by row from the bottom
+	std::vector<float> costs;
+	int samples = 0;
+	GLuint tex = 0;
+	std::unique_ptr<shader_program> overlay;
+	
+	cost_heatmap(const cost_heatmap &) = delete;
+	cost_heatmap &operator=(const cost_heatmap &) = delete;
+	
+	cost_heatmap()
+	{
+		static const std::string source = 
+		"#version 430 core\n"
+		
+		"in VS_OUT"
+		"{"
+		"	vec2 uv;"
+		"} vs_out;"
+		
+		"layout (binding = 0) uniform sampler2D costs;"
+		"layout (location = 0) uniform float scale;"
+		"out vec4 f_color;"
+		
+		"void main()"
+		"{"
+		"	float t = clamp(texture(costs, vs_out.uv).r * scale, 0.0, 1.0);"
+		"	vec3 heat = clamp(vec3(1.5) - abs(vec3(4.0 * t) - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);"
+		"	vec2 edge = abs(fract(vs_out.uv * vec2(textureSize(costs, 0))) - 0.5);"
+		"	f_color = vec4(heat, max(edge.x, edge.y) > 0.48 ? 0.8 : 0.45);"
+		"}";
+		
+		overlay = make_builtin_program(source);
+	}
+	
+	~cost_heatmap()
+	{
+		for (auto &q : queries)
+			if (!q.empty()) glDeleteQueries(q.size(), q.data());
+		if (tex) glDeleteTextures(1, &tex);
 	}
 	
-	~texture()
+	// Changing the grid starts measuring from scratch
+	void resize(int c, int r)
 	{
+		if (c == columns && r == rows) return;
+		
+		columns = c;
+		rows = r;
+		for (int i = 0; i < ring_size; i++)
+		{
+			if (!queries[i].empty()) glDeleteQueries(queries[i].size(), queries[i].data());
+			queries[i].resize(columns * rows + 1);
+			glCreateQueries(GL_TIMESTAMP, queries[i].size(), queries[i].data());
+			pending[i] = false;
+		}
+		
 		if (tex) glDeleteTextures(1, &tex);
-		if (data) stbi_image_free(data);
+		glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+		glTextureStorage2D(tex, 1, GL_R32F, columns, rows);
+		glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		reset();
+	}
+	
+	void reset()
+	{
+		costs.assign(columns * rows, 0.0f);
+		samples = 0;
+	}
+	
+	// Draws the fullscreen pass tile by tile into the bound target
+	void draw(int width, int height)
+	{
+		std::vector<GLuint> &q = queries[slot];
+		bool measure = !pending[slot];
+		
+		glEnable(GL_SCISSOR_TEST);
+		if (measure) glQueryCounter(q[0], GL_TIMESTAMP);
+		for (int y = 0; y < rows; y++)
+			for (int x = 0; x < columns; x++)
+			{
+				int x0 = width * x / columns, x1 = width * (x + 1) / columns;
+				int y0 = height * y / rows, y1 = height * (y + 1) / rows;
+				glScissor(x0, y0, x1 - x0, y1 - y0);
+				glDrawArrays(GL_TRIANGLES, 0, 6);
+				if (measure) glQueryCounter(q[y * columns + x + 1], GL_TIMESTAMP);
+			}
+		glDisable(GL_SCISSOR_TEST);
+		
+		pending[slot] = measure;
+		slot = (slot + 1) % ring_size;
+	}
+	
+	// Averages in the finished frames, without waiting for the GPU
+	void collect()
+	{
+		for (int i = 0; i < ring_size; i++)
+		{
+			int s = (slot + i) % ring_size;
+			if (!pending[s]) continue;
+			
+			GLint available;
+			glGetQueryObjectiv(queries[s].back(), GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			
+			// The first frames are averaged evenly, later ones decay
+			float weight = 1.0f / std::min(++samples, 16);
+			GLuint64 previous;
+			glGetQueryObjectui64v(queries[s][0], GL_QUERY_RESULT, &previous);
+			for (int t = 0; t < columns * rows; t++)
+			{
+				GLuint64 time;
+				glGetQueryObjectui64v(queries[s][t + 1], GL_QUERY_RESULT, &time);
+				costs[t] += ((time - previous) * 1e-6f - costs[t]) * weight;
+				previous = time;
+			}
+			pending[s] = false;
+		}
+	}
+	
+	float max_cost() const
+	{
+		return costs.empty() ? 0.0f : *std::max_element(costs.begin(), costs.end());
+	}
+	
+	// Blends the colour-mapped costs over the bound framebuffer, the most expensive tile in red
+	void draw_overlay()
+	{
+		glTextureSubImage2D(tex, 0, 0, 0, columns, rows, GL_RED, GL_FLOAT, costs.data());
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glUseProgram(overlay->id);
+		glBindTextureUnit(0, tex);
+		float max = max_cost();
+		glUniform1f(0, max > 0.0f ? 1.0f / max : 0.0f);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glDisable(GL_BLEND);
+	}
+};
+
+/*
+	Shades only a subset of pixels each frame into a smaller sample buffer
+	and rebuilds the rest of the image from the previous output. History
+	is clamped to the neighbourhood of fresh samples to limit ghosting.
+*/
+struct interleaved_renderer
+{
+	interleave_mode mode = interleave_mode::off;
+	std::unique_ptr<shader_program> resolve;
+	std::unique_ptr<render_target> samples;
+	std::unique_ptr<render_target> history[2];
+	std::unique_ptr<render_target> preview;
+	int current = 0;
+	unsigned int phase = 0;
+	bool history_valid = false;
+	
+	// When set, the shader pass is timed tile by tile
+	cost_heatmap *heatmap = nullptr;
+	
+	interleaved_renderer(const interleaved_renderer &) = delete;
+	interleaved_renderer &operator=(const interleaved_renderer &) = delete;
+	
+	interleaved_renderer()
+	{
+		static const std::string source = 
+		"#version 430 core\n"
+		
+		"in VS_OUT"
+		"{"
+		"	vec2 uv;"
+		"} vs_out;"
+		
+		"layout (binding = 0) uniform sampler2D samples;"
+		"layout (binding = 1) uniform sampler2D history;"
+		"layout (location = 0) uniform int mode;"
+		"layout (location = 1) uniform ivec2 phase;"
+		"layout (location = 2) uniform bool history_valid;"
+		"out vec4 f_color;"
+		
+		"vec4 fetch(ivec2 cell)"
+		"{"
+		"	return texelFetch(samples, clamp(cell, ivec2(0), textureSize(samples, 0) - 1), 0);"
+		"}"
+		
+		"void main()"
+		"{"
+		"	ivec2 p = ivec2(gl_FragCoord.xy);"
+		"	vec4 s[4];"
+		"	vec4 spatial;"
+		
+		"	if (mode == 1)"
+		"	{"
+		"		if (((p.x ^ (p.y + phase.x)) & 1) == 0)"
+		"		{"
+		"			f_color = fetch(ivec2(p.x >> 1, p.y));"
+		"			return;"
+		"		}"
+		
+		"		s[0] = fetch(ivec2((p.x - 1) >> 1, p.y));"
+		"		s[1] = fetch(ivec2((p.x + 1) >> 1, p.y));"
+		"		s[2] = fetch(ivec2(p.x >> 1, p.y - 1));"
+		"		s[3] = fetch(ivec2(p.x >> 1, p.y + 1));"
+		"		spatial = (s[0] + s[1] + s[2] + s[3]) * 0.25;"
+		"	}"
+		"	else"
+		"	{"
+		"		ivec2 base = (p - phase) >> 1;"
+		"		ivec2 sub = (p - phase) & 1;"
+		"		if (sub == ivec2(0))"
+		"		{"
+		"			f_color = fetch(base);"
+		"			return;"
+		"		}"
+		
+		"		s[0] = fetch(base);"
+		"		s[1] = fetch(base + ivec2(1, 0));"
+		"		s[2] = fetch(base + ivec2(0, 1));"
+		"		s[3] = fetch(base + ivec2(1, 1));"
+		"		vec2 f = vec2(sub) * 0.5;"
+		"		spatial = mix(mix(s[0], s[1], f.x), mix(s[2], s[3], f.x), f.y);"
+		"	}"
+		
+		"	vec4 lo = min(min(s[0], s[1]), min(s[2], s[3]));"
+		"	vec4 hi = max(max(s[0], s[1]), max(s[2], s[3]));"
+		"	f_color = history_valid ? clamp(texelFetch(history, p, 0), lo, hi) : spatial;"
+		"}";
+		
+		resolve = make_builtin_program(source);
+	}
+	
+	void set_mode(interleave_mode m)
+	{
+		if (m != mode)
+		{
+			mode = m;
+			history_valid = false;
+		}
+	}
+	
+	void invalidate()
+	{
+		history_valid = false;
+	}
+	
+	// Number of frames needed to shade every pixel once
+	int phase_count() const
+	{
+		glm::ivec2 step = stride();
+		return step.x * step.y;
+	}
+	
+	glm::ivec2 stride() const
+	{
+		switch (mode)
+		{
+			case interleave_mode::checkerboard: return glm::ivec2(2, 1);
+			case interleave_mode::quarter: return glm::ivec2(2, 2);
+			default: return glm::ivec2(1, 1);
+		}
+	}
+	
+	/*
+		Shades the program, which must already have its own uniforms set,
+		and returns the full resolution image. The origin moves fragCoord
+		when only a tile of a larger image is rendered.
+	*/
+	const render_target &render(const shader_program &program, int width, int height, int downscale = 1, glm::vec2 origin = glm::vec2(0.0f))
+	{
+		// Reduced resolution preview - every pixel of a smaller image, stretched when presented
+		if (downscale > 1)
+		{
+			int preview_w = std::max(width / downscale, 1);
+			int preview_h = std::max(height / downscale, 1);
+			if (!preview || preview->width != preview_w || preview->height != preview_h)
+				preview = std::make_unique<render_target>(preview_w, preview_h);
+			
+			glm::vec2 scale(float(width) / preview_w, float(height) / preview_h);
+			preview->bind();
+			glUseProgram(program.id);
+			glUniform2f(program.location("sd_stride"), scale.x, scale.y);
+			glUniform2f(program.location("sd_offset"), origin.x + scale.x * 0.5f, origin.y + scale.y * 0.5f);
+			glUniform1i(program.location("sd_row_shift"), -1);
+			draw_pass(*preview);
+			
+			history_valid = false;
+			return *preview;
+		}
+		
+		glm::ivec2 step = stride();
+		int samples_w = (width + step.x - 1) / step.x;
+		int samples_h = (height + step.y - 1) / step.y;
+		
+		if (!samples || samples->width != samples_w || samples->height != samples_h)
+		{
+			samples = std::make_unique<render_target>(samples_w, samples_h);
+			history_valid = false;
+		}
+		
+		if (mode != interleave_mode::off && (!history[0] || history[0]->width != width || history[0]->height != height))
+		{
+			history[0] = std::make_unique<render_target>(width, height);
+			history[1] = std::make_unique<render_target>(width, height);
+			history_valid = false;
+		}
+		
+		// Which of the pixels are shaded in this frame
+		static const glm::ivec2 quarter_sequence[4] = {{0, 0}, {1, 1}, {1, 0}, {0, 1}};
+		glm::ivec2 offset(0, 0);
+		int row_shift = -1;
+		if (mode == interleave_mode::checkerboard)
+			row_shift = phase & 1;
+		else if (mode == interleave_mode::quarter)
+			offset = quarter_sequence[phase & 3];
+		
+		samples->bind();
+		glUseProgram(program.id);
+		glUniform2f(program.location("sd_stride"), step.x, step.y);
+		glUniform2f(program.location("sd_offset"), origin.x + offset.x + 0.5f, origin.y + offset.y + 0.5f);
+		glUniform1i(program.location("sd_row_shift"), row_shift);
+		draw_pass(*samples);
+		
+		if (mode == interleave_mode::off)
+			return *samples;
+		
+		// Reconstruct
+		const render_target &output = *history[current];
+		const render_target &previous = *history[current ^ 1];
+		output.bind();
+		glUseProgram(resolve->id);
+		glBindTextureUnit(0, samples->tex);
+		glBindTextureUnit(1, previous.tex);
+		glUniform1i(0, mode == interleave_mode::checkerboard ? 1 : 2);
+		glUniform2i(1, row_shift >= 0 ? row_shift : offset.x, offset.y);
+		glUniform1i(2, history_valid);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		
+		current ^= 1;
+		phase++;
+		history_valid = true;
+		return output;
+	}
+	
+	void draw_pass(const render_target &target)
+	{
+		if (heatmap)
+			heatmap->draw(target.width, target.height);
+		else
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+};
+
+// What the GUI needs to know about the current program
+struct program_info
+{
+	unsigned long serial;
+	shader_inputs inputs;
+	std::vector<control_info> controls;
+	std::string source;
+};
+
+// Static metrics of a program compiled to SPIR-V
+struct shader_cost
+{
+	bool valid = false;
+	std::string error;
+	int instructions = 0;
+	int functions = 0;
+	int calls = 0;
+	int loops = 0;
+	int branches = 0;
+	int texture_samples = 0;
+	
+	// Most SSA values alive at once in a function, ignoring loop back edges
+	int live_values = 0;
+};
+
+/*
+	Counts the instructions inside function bodies. Ids used as operands
+	are told from literals only by having been defined in the same
+	function, which is good enough for an estimate of register pressure.
+*/
+shader_cost analyze_spirv(const std::vector<uint32_t> &words)
+{
+	enum : uint32_t
+	{
+		op_function = 54,
+		op_function_end = 56,
+		op_function_call = 57,
+		op_image_sample_first = 87,
+		op_image_dref_gather = 97,
+		op_loop_merge = 246,
+		op_label = 248,
+		op_branch_conditional = 250,
+		op_switch = 251,
+	};
+	
+	// Instructions that can appear in a function body without a result
+	static const uint32_t no_result[] = {8, 56, 62, 63, 99, 224, 225, 246, 247, 249, 250, 251, 252, 253, 254, 255, 317, 4416};
+	
+	shader_cost cost;
+	if (words.size() < 5 || words[0] != 0x07230203)
+	{
+		cost.error = "not a SPIR-V module";
+		return cost;
+	}
+	
+	std::map<uint32_t, int> defined, last_use;
+	auto finish_function = [&]()
+	{
+		std::vector<int> delta(cost.instructions + 2, 0);
+		for (const auto &[id, position] : defined)
+		{
+			auto use = last_use.find(id);
+			if (use == last_use.end()) continue;
+			delta[position]++;
+			delta[use->second + 1]--;
+		}
+		
+		int live = 0;
+		for (int d : delta)
+			cost.live_values = std::max(cost.live_values, live += d);
+		defined.clear();
+		last_use.clear();
+	};
+	
+	bool in_function = false;
+	for (size_t i = 5; i < words.size();)
+	{
+		uint32_t opcode = words[i] & 0xffff;
+		uint32_t count = words[i] >> 16;
+		if (count == 0 || i + count > words.size())
+		{
+			cost.error = "truncated SPIR-V module";
+			return cost;
+		}
+		
+		if (opcode == op_function)
+		{
+			in_function = true;
+			cost.functions++;
+		}
+		else if (in_function && opcode != op_label)
+		{
+			int position = cost.instructions++;
+			bool has_result = std::find(std::begin(no_result), std::end(no_result), opcode) == std::end(no_result);
+			uint32_t first_operand = has_result ? 3 : 1;
+			for (uint32_t w = first_operand; w < count; w++)
+				if (defined.count(words[i + w]))
+					last_use[words[i + w]] = position;
+			if (has_result && count > 2)
+				defined[words[i + 2]] = position;
+			
+			if (opcode == op_function_call) cost.calls++;
+			else if (opcode == op_loop_merge) cost.loops++;
+			else if (opcode == op_branch_conditional || opcode == op_switch) cost.branches++;
+			else if (opcode >= op_image_sample_first && opcode <= op_image_dref_gather) cost.texture_samples++;
+			
+			if (opcode == op_function_end)
+			{
+				in_function = false;
+				finish_function();
+			}
+		}
+		
+		i += count;
+	}
+	
+	cost.valid = true;
+	return cost;
+}
+
+/*
+	Compiles a program's source to SPIR-V with glslangValidator, optionally
+	optimizes it with spirv-opt, and analyzes the result. Runs the tools
+	as separate processes, so it's meant to be called off the GUI thread.
+*/
+shader_cost measure_shader_cost(const std::string &source, bool optimize)
+{
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string base = (tmpdir ? tmpdir : "/tmp") + "/shaderdude-"s + std::to_string(getpid()) + "-"s + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::string glsl = base + ".frag", spv = base + ".spv", log = base + ".log";
+	
+	shader_cost cost;
+	try
+	{
+		{
+			std::ofstream f(glsl);
+			f << source;
+			if (!f) throw std::runtime_error("could not write '"s + glsl + "'"s);
+		}
+		
+		// No shell involved, so the paths need no quoting. Both outputs go to the log.
+		auto run = [&](std::vector<std::string> args)
+		{
+			std::vector<char*> argv;
+			for (auto &arg : args)
+				argv.push_back(arg.data());
+			argv.push_back(nullptr);
+			
+			posix_spawn_file_actions_t actions;
+			posix_spawn_file_actions_init(&actions);
+			posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+			
+			pid_t pid;
+			int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+			posix_spawn_file_actions_destroy(&actions);
+			
+			int status = 0;
+			if (err == 0 && waitpid(pid, &status, 0) < 0)
+				err = errno;
+			if (err == ENOENT || (err == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 127))
+				throw std::runtime_error(args[0] + " not found");
+			if (err != 0)
+				throw std::runtime_error("could not run "s + args[0] + ": "s + std::strerror(err));
+			if (status != 0)
+				throw std::runtime_error(args[0] + " failed:\n"s + slurp_txt(log));
+		};
+		
+		// OpenGL SPIR-V wants explicit locations, which the tools can assign
+		run({"glslangValidator", "-G", "--aml", "--amb", "-S", "frag", "-o", spv, glsl});
+		if (optimize)
+			run({"spirv-opt", "-O", spv, "-o", spv});
+		
+		std::ifstream f(spv, std::ios::binary);
+		std::vector<uint32_t> words;
+		uint32_t word;
+		while (f.read(reinterpret_cast<char*>(&word), sizeof(word)))
+			words.push_back(word);
+		cost = analyze_spirv(words);
+	}
+	catch (const std::exception &ex)
+	{
+		cost.error = ex.what();
+	}
+	
+	std::remove(glsl.c_str());
+	std::remove(spv.c_str());
+	std::remove(log.c_str());
+	return cost;
+}
+
+// Keeps the analysis of the current and the previous program, one run at a time
+struct shader_cost_tracker
+{
+	unsigned long serial = 0;
+	bool optimize = false;
+	std::future<shader_cost> running;
+	std::shared_ptr<const program_info> queued;
+	shader_cost current;
+	shader_cost previous;
+	
+	// A program that comes in while the tools are busy waits for them
+	void update(const std::shared_ptr<const program_info> &info)
+	{
+		if (info && info->serial != serial)
+		{
+			serial = info->serial;
+			queued = info;
+		}
+		
+		if (running.valid() && running.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			shader_cost cost = running.get();
+			if (current.valid)
+				previous = current;
+			current = cost;
+		}
+		
+		if (!running.valid() && queued)
+		{
+			running = std::async(std::launch::async, measure_shader_cost, queued->source, optimize);
+			queued.reset();
+		}
+	}
+	
+	// Analyzes the current program again, e.g. after toggling optimization
+	void refresh()
+	{
+		serial = 0;
+	}
+};
+
+/*
+	Lock-free handoff of the most recent value from one producer thread to
+	one consumer thread. The writer fills write_buffer() and publishes it,
+	the reader picks up the latest published value with update(). Neither
+	side ever waits for the other - values may be skipped, never torn.
+*/
+template <typename T>
+struct triple_buffer
+{
+	static constexpr int index_mask = 3;
+	static constexpr int fresh_bit = 4;
+	
+	T slots[3];
+	std::atomic<int> middle{1};
+	int back = 0;
+	int front = 2;
+	
+	T &write_buffer()
+	{
+		return slots[back];
+	}
+	
+	void publish()
+	{
+		back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+	}
+	
+	// Returns true if a new value has been published since the last call
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+		return true;
+	}
+	
+	T &read_buffer()
+	{
+		return slots[front];
+	}
+};
+
+// Lets an idle thread sleep until there's something new for it
+struct wakeup
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool pending = false;
+	
+	void notify()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = true;
+		}
+		cv.notify_one();
+	}
+	
+	void wait(double timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait_for(lock, std::chrono::duration<double>(timeout), [this]{return pending;});
+		pending = false;
+	}
+};
+
+// Mouse state as of the most recent input event
+struct input_sample
+{
+	glm::vec4 mouse = glm::vec4(0.0f);
+	double time = 0.0;
+};
+
+/*
+	Ring of persistently mapped uniform buffer slots holding the sd_input
+	block, one per frame in flight. Inputs are written into the slot right
+	before the shader pass, fences keep the CPU at most frames_in_flight
+	frames ahead of the GPU and timestamp queries tell when each frame was
+	actually finished, so input-to-present latency can be measured.
+*/
+struct frame_pacer
+{
+	static constexpr int max_frames_in_flight = 3;
+	static constexpr int history_size = 64;
+	
+	// std140 layout of sd_input
+	struct block
+	{
+		glm::vec4 mouse;
+		float time;
+		float padding[3];
+	};
+	
+	GLuint buffer;
+	GLint slot_size;
+	uint8_t *mapped;
+	GLsync fences[max_frames_in_flight] = {};
+	GLuint queries[max_frames_in_flight];
+	double input_times[max_frames_in_flight] = {};
+	double latch_times[max_frames_in_flight] = {};
+	int frames_in_flight = 2;
+	int slot = 0;
+	long frame_counter = 0;
+	
+	// CPU time minus GPU time
+	double clock_offset = 0.0;
+	double last_input_time = 0.0;
+	
+	// Input to latch and input to GPU completion, in ms
+	float latch_history[history_size] = {};
+	float latency_history[history_size] = {};
+	int history_count = 0;
+	
+	frame_pacer(const frame_pacer &) = delete;
+	frame_pacer &operator=(const frame_pacer &) = delete;
+	
+	frame_pacer()
+	{
+		GLint alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		slot_size = (sizeof(block) + alignment - 1) / alignment * alignment;
+		
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, slot_size * max_frames_in_flight, nullptr, flags);
+		mapped = static_cast<uint8_t*>(glMapNamedBufferRange(buffer, 0, slot_size * max_frames_in_flight, flags));
+		glCreateQueries(GL_TIMESTAMP, max_frames_in_flight, queries);
+		calibrate();
+	}
+	
+	~frame_pacer()
+	{
+		drain();
+		glDeleteQueries(max_frames_in_flight, queries);
+		glUnmapNamedBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+	
+	void calibrate()
+	{
+		GLint64 gpu_time;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+		clock_offset = get_time() - gpu_time * 1e-9;
+	}
+	
+	// Waits for the frame that used this slot before and collects its timing
+	void retire(int i)
+	{
+		if (!fences[i]) return;
+		glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fences[i]);
+		fences[i] = nullptr;
+		
+		if (input_times[i] > 0.0)
+		{
+			GLuint64 done;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &done);
+			int n = history_count++ % history_size;
+			latency_history[n] = (done * 1e-9 + clock_offset - input_times[i]) * 1000.0;
+			latch_history[n] = (latch_times[i] - input_times[i]) * 1000.0;
+		}
+	}
+	
+	void drain()
+	{
+		for (int i = 0; i < max_frames_in_flight; i++)
+			retire(i);
+	}
+	
+	void set_frames_in_flight(int n)
+	{
+		n = std::clamp(n, 1, max_frames_in_flight);
+		if (n == frames_in_flight) return;
+		drain();
+		frames_in_flight = n;
+		slot = 0;
+	}
+	
+	// Blocks while too many frames are queued - call before sampling input
+	void begin_frame()
+	{
+		retire(slot);
+		input_times[slot] = 0.0;
+		if (frame_counter++ % 256 == 0)
+			calibrate();
+	}
+	
+	// Writes the latest input into this frame's slot and binds it
+	void latch(const input_sample &input, float time)
+	{
+		block *b = reinterpret_cast<block*>(mapped + slot * slot_size);
+		b->mouse = input.mouse;
+		b->time = time;
+		glBindBufferRange(GL_UNIFORM_BUFFER, 0, buffer, slot * slot_size, sizeof(block));
+		
+		// Only frames showing new input tell anything about latency
+		if (input.time > last_input_time)
+		{
+			last_input_time = input.time;
+			input_times[slot] = input.time;
+			latch_times[slot] = get_time();
+		}
+	}
+	
+	// Call after the swap
+	void end_frame()
+	{
+		glQueryCounter(queries[slot], GL_TIMESTAMP);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot = (slot + 1) % frames_in_flight;
+	}
+	
+	// Average and maximum of the recorded history
+	void stats(const float *history, float &avg, float &max) const
+	{
+		int n = std::min(history_count, history_size);
+		avg = max = 0.0f;
+		for (int i = 0; i < n; i++)
+		{
+			avg += history[i] / n;
+			max = std::max(max, history[i]);
+		}
+	}
+};
+
+/*
+	Ring of GL_TIME_ELAPSED queries. Results are picked up only once the
+	GPU has them, so measuring never stalls the pipeline - unless the
+	ring is full, then the oldest query is waited for.
+*/
+struct gpu_timer
+{
+	static constexpr int ring_size = 8;
+	
+	GLuint queries[ring_size];
+	int head = 0;
+	int pending = 0;
+	std::vector<double> results;
+	
+	gpu_timer(const gpu_timer &) = delete;
+	gpu_timer &operator=(const gpu_timer &) = delete;
+	
+	gpu_timer()
+	{
+		glCreateQueries(GL_TIME_ELAPSED, ring_size, queries);
+	}
+	
+	~gpu_timer()
+	{
+		glDeleteQueries(ring_size, queries);
+	}
+	
+	void begin()
+	{
+		if (pending == ring_size)
+			collect(true);
+		glBeginQuery(GL_TIME_ELAPSED, queries[(head + pending) % ring_size]);
+	}
+	
+	void end()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		pending++;
+	}
+	
+	// Moves finished measurements, in ms, to results
+	void collect(bool wait = false)
+	{
+		while (pending > 0)
+		{
+			GLint available = GL_TRUE;
+			if (!wait)
+				glGetQueryObjectiv(queries[head], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			
+			GLuint64 elapsed;
+			glGetQueryObjectui64v(queries[head], GL_QUERY_RESULT, &elapsed);
+			results.push_back(elapsed * 1e-6);
+			head = (head + 1) % ring_size;
+			pending--;
+			wait = false;
+		}
+	}
+	
+	void drain()
+	{
+		while (pending > 0)
+			collect(true);
+	}
+};
+
+double median(std::vector<double> values)
+{
+	if (values.empty()) return 0.0;
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+/*
+	Whether GL_TIME_ELAPSED queries cover all the work of a draw. On
+	software rasterizers such as llvmpipe most of it happens where the
+	query doesn't see it - there a query of a draw comes out a small
+	fraction of the wall clock time of the same draw with the pipeline
+	drained. The draws are repeated until they take long enough for the
+	submission overhead not to matter.
+*/
+bool timer_queries_cover_draws()
+{
+	static const std::string source = 
+	"#version 430 core\n"
+	"out vec4 f_color;"
+	"void main()"
+	"{"
+	"	float a = 0.0;"
+	"	for (int i = 0; i < 64; i++)"
+	"		a += sin(gl_FragCoord.x * float(i) + a);"
+	"	f_color = vec4(a);"
+	"}";
+	
+	auto prog = make_builtin_program(source);
+	render_target target(512, 512);
+	target.bind();
+	glUseProgram(prog->id);
+	
+	gpu_timer timer;
+	std::vector<double> ratios;
+	for (int passes = 1; ratios.size() < 3;)
+	{
+		glFinish();
+		double start = get_time();
+		timer.begin();
+		for (int i = 0; i < passes; i++)
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		timer.end();
+		glFinish();
+		double wall_ms = (get_time() - start) * 1000.0;
+		timer.drain();
+		
+		if (wall_ms < 5.0 && passes < 4096)
+			passes *= 2;
+		else
+			ratios.push_back(timer.results.back() / wall_ms);
+	}
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return median(ratios) > 0.5;
+}
+
+// Outcome of comparing a new version of the shader with the previous one
+struct ab_result
+{
+	bool valid = false;
+	int samples = 0;
+	float baseline_ms = 0.0f;
+	float new_ms = 0.0f;
+	
+	// Median change and its 95% confidence interval, in percent
+	float change = 0.0f;
+	float low = 0.0f;
+	float high = 0.0f;
+};
+
+/*
+	After a reload, the previous and the new program are both drawn every
+	frame for a while, with the same inputs, into scratch targets, so
+	both see the same load on the GPU. The result is the ratio of the
+	median times, with a confidence interval from bootstrap resampling.
+*/
+struct ab_comparison
+{
+	static constexpr int calibration_frames = 64;
+	
+	std::unique_ptr<shader_program> baseline;
+	std::shared_ptr<const program_info> baseline_info;
+	std::vector<glm::vec4> baseline_controls;
+	std::unique_ptr<render_target> scratch[2];
+	gpu_timer timers[2];
+	int frames = 0;
+	
+	ab_comparison(const ab_comparison &) = delete;
+	ab_comparison &operator=(const ab_comparison &) = delete;
+	
+	ab_comparison(std::unique_ptr<shader_program> prog, std::shared_ptr<const program_info> info, const std::vector<glm::vec4> &controls) :
+		baseline(std::move(prog)),
+		baseline_info(std::move(info)),
+		baseline_controls(controls)
+	{
+	}
+	
+	// Draws every pixel once, the program's uniforms must already be set
+	void time_pass(const shader_program &prog, int which, int width, int height)
+	{
+		// Separate targets keep the passes apart on tilers and software rasterizers
+		if (!scratch[which] || scratch[which]->width != width || scratch[which]->height != height)
+			scratch[which] = std::make_unique<render_target>(width, height);
+		scratch[which]->bind();
+		glUniform2f(prog.location("sd_stride"), 1.0f, 1.0f);
+		glUniform2f(prog.location("sd_offset"), 0.5f, 0.5f);
+		glUniform1i(prog.location("sd_row_shift"), -1);
+		timers[which].begin();
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		timers[which].end();
+		timers[which].collect();
+	}
+	
+	bool done() const
+	{
+		return frames >= calibration_frames;
+	}
+	
+	ab_result result()
+	{
+		for (auto &t : timers)
+			t.drain();
+		
+		const std::vector<double> &a = timers[0].results, &b = timers[1].results;
+		ab_result r;
+		r.samples = std::min(a.size(), b.size());
+		if (r.samples < 8) return r;
+		
+		auto median = [](std::vector<double> &v)
+		{
+			std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+			return v[v.size() / 2];
+		};
+		
+		std::vector<double> sa = a, sb = b;
+		r.baseline_ms = median(sa);
+		r.new_ms = median(sb);
+		if (r.baseline_ms <= 0.0f) return r;
+		
+		// Fixed seed - the same measurements always give the same interval
+		constexpr int resamples = 1000;
+		std::mt19937 rng(1);
+		std::vector<double> changes(resamples);
+		for (double &change : changes)
+		{
+			for (double &v : sa) v = a[rng() % a.size()];
+			for (double &v : sb) v = b[rng() % b.size()];
+			change = median(sb) / std::max(median(sa), 1e-9) - 1.0;
+		}
+		std::sort(changes.begin(), changes.end());
+		
+		r.valid = true;
+		r.change = (r.new_ms / r.baseline_ms - 1.0f) * 100.0f;
+		r.low = changes[resamples * 25 / 1000] * 100.0;
+		r.high = changes[resamples * 975 / 1000] * 100.0;
+		return r;
+	}
+};
+
+// History of one measurement, written by one thread and plotted by another without locking
+struct profile_series
+{
+	static constexpr int size = 240;
+	
+	std::atomic<float> values[size] = {};
+	std::atomic<unsigned> count{0};
+	
+	void push(float value)
+	{
+		unsigned n = count.load(std::memory_order_relaxed);
+		values[n % size].store(value, std::memory_order_relaxed);
+		count.store(n + 1, std::memory_order_release);
+	}
+	
+	// Copies the history out, oldest first, and returns its length
+	int read(float *out) const
+	{
+		unsigned n = count.load(std::memory_order_acquire);
+		int length = std::min<unsigned>(n, size);
+		for (int i = 0; i < length; i++)
+			out[i] = values[(n - length + i) % size].load(std::memory_order_relaxed);
+		return length;
+	}
+};
+
+// What the profiler shows, in ms - each series has a single writer
+struct frame_profile
+{
+	// Render thread
+	profile_series gpu_pass;
+	profile_series gpu_present;
+	profile_series gpu_gui;
+	profile_series gpu_swap;
+	profile_series gpu_frame;
+	profile_series cpu_uniforms;
+	profile_series cpu_draw;
+	profile_series cpu_swap;
+	profile_series cpu_frame;
+	profile_series render_allocations;
+	
+	// Main thread
+	profile_series cpu_poll;
+	profile_series cpu_gui;
+	profile_series cpu_watcher;
+	profile_series main_allocations;
+};
+
+/*
+	GL_TIMESTAMP queries at the boundaries of the stages of a frame. Old
+	frames are read back once their results are available - when the GPU
+	is so far behind that the ring is full, a frame just isn't measured.
+*/
+struct stage_timer
+{
+	static constexpr int ring_size = 4;
+	static constexpr int max_marks = 8;
+	
+	GLuint queries[ring_size][max_marks];
+	int marks[ring_size] = {};
+	bool pending[ring_size] = {};
+	int slot = 0;
+	bool measuring = false;
+	
+	stage_timer(const stage_timer &) = delete;
+	stage_timer &operator=(const stage_timer &) = delete;
+	
+	stage_timer()
+	{
+		for (auto &q : queries)
+			glCreateQueries(GL_TIMESTAMP, max_marks, q);
+	}
+	
+	~stage_timer()
+	{
+		for (auto &q : queries)
+			glDeleteQueries(max_marks, q);
+	}
+	
+	void begin_frame()
+	{
+		measuring = !pending[slot];
+		marks[slot] = 0;
+		mark();
+	}
+	
+	// Ends the current stage and starts the next one
+	void mark()
+	{
+		if (measuring && marks[slot] < max_marks)
+			glQueryCounter(queries[slot][marks[slot]++], GL_TIMESTAMP);
+	}
+	
+	void end_frame()
+	{
+		pending[slot] = measuring;
+		slot = (slot + 1) % ring_size;
+	}
+	
+	/*
+		Calls consume(times, count) for every finished frame, oldest first.
+		The marks are converted to seconds on the get_time() clock, so they
+		line up with CPU timings.
+	*/
+	template <typename F>
+	void collect(F &&consume)
+	{
+		double offset = 0.0;
+		bool calibrated = false;
+		
+		for (int i = 0; i < ring_size; i++)
+		{
+			int s = (slot + i) % ring_size;
+			if (!pending[s]) continue;
+			
+			GLint available;
+			glGetQueryObjectiv(queries[s][marks[s] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+			
+			if (!calibrated)
+			{
+				GLint64 gpu_now;
+				glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+				offset = get_time() - gpu_now * 1e-9;
+				calibrated = true;
+			}
+			
+			double times[max_marks];
+			for (int m = 0; m < marks[s]; m++)
+			{
+				GLuint64 t;
+				glGetQueryObjectui64v(queries[s][m], GL_QUERY_RESULT, &t);
+				times[m] = t * 1e-9 + offset;
+			}
+			
+			consume(times, marks[s]);
+			pending[s] = false;
+		}
+	}
+};
+
+// Deep copy of ImGui draw data, so it can be rendered on another thread
+struct gui_snapshot
+{
+	ImDrawData data = {};
+	std::vector<std::unique_ptr<ImDrawList>> lists;
+	std::vector<ImDrawList*> pointers;
+	
+	// Unlike ImVector::operator=, resize() keeps the storage once it's large enough
+	template <typename T>
+	static void copy_vector(ImVector<T> &dst, const ImVector<T> &src)
+	{
+		dst.resize(src.Size);
+		if (src.Size) std::memcpy(dst.Data, src.Data, src.Size * sizeof(T));
+	}
+	
+	void copy(const ImDrawData &src)
+	{
+		while (lists.size() < src.CmdListsCount)
+			lists.push_back(std::make_unique<ImDrawList>(nullptr));
+		pointers.resize(src.CmdListsCount);
+		
+		for (int i = 0; i < src.CmdListsCount; i++)
+		{
+			copy_vector(lists[i]->CmdBuffer, src.CmdLists[i]->CmdBuffer);
+			copy_vector(lists[i]->IdxBuffer, src.CmdLists[i]->IdxBuffer);
+			copy_vector(lists[i]->VtxBuffer, src.CmdLists[i]->VtxBuffer);
+			lists[i]->Flags = src.CmdLists[i]->Flags;
+			pointers[i] = lists[i].get();
+		}
+		
+		data = src;
+		data.CmdLists = pointers.data();
+	}
+};
+
+// Everything the render thread needs for a frame, published by the main thread
+struct frame_request
+{
+	int width = 0;
+	int height = 0;
+	long shader_generation = 0;
+	double shader_saved = 0.0;
+	double shader_detected = 0.0;
+	unsigned long program_serial = 0;
+	std::vector<glm::vec4> controls;
+	interleave_mode mode = interleave_mode::off;
+	int preview_downscale = 1;
+	bool interacting = false;
+	int frames_in_flight = 2;
+	int heatmap_columns = 0;
+	gui_snapshot gui;
+};
+
+// Published back to the main thread after every frame
+struct render_status
+{
+	std::shared_ptr<const program_info> program;
+	float frame_ms = 0.0f;
+	float latch_ms = 0.0f;
+	float latency_ms = 0.0f;
+	float latency_max_ms = 0.0f;
+	float heatmap_max_ms = 0.0f;
+	float heatmap_total_ms = 0.0f;
+	bool comparing = false;
+	ab_result comparison;
+	
+	// Timer queries only see part of the work, so their times are only good for comparisons
+	bool relative_timing = false;
+	
+	// Latest reloads, oldest first
+	static constexpr int reload_history = 16;
+	reload_timing reloads[reload_history];
+	int reload_count = 0;
+};
+
+struct render_link
+{
+	triple_buffer<frame_request> requests;
+	triple_buffer<render_status> status;
+	
+	// Written straight from the event callbacks, so the render thread can latch it late
+	input_sample input;
+	triple_buffer<input_sample> inputs;
+	
+	wakeup wake;
+	std::atomic<bool> quit{false};
+	frame_profile profile;
+};
+
+/*
+	Owns the GL side of the preview - the program, render targets and the
+	state of the last rendered frame. Lives on the render thread.
+*/
+struct renderer
+{
+	std::string shader_path;
+	const std::vector<texture> &textures;
+	GLuint vao;
+	std::unique_ptr<shader_program> program;
+	std::shared_ptr<const program_info> info;
+	shader_inputs inputs;
+	std::unique_ptr<interleaved_renderer> interleaved;
+	std::unique_ptr<shader_program> present_program;
+	std::unique_ptr<cost_heatmap> heatmap;
+	std::unique_ptr<ab_comparison> ab;
+	ab_result comparison;
+	const render_target *output = nullptr;
+	
+	// Progress of the last reload until it's been on screen
+	reload_timing reload_time;
+	bool reload_pending = false;
+	
+	long shader_generation = 0;
+	unsigned long program_serial = 0;
+	double shader_start_time = 0.0;
+	long frame_counter = 0;
+	
+	// Inputs of the last rendered frame
+	int width = 0;
+	int height = 0;
+	glm::vec4 mouse = glm::vec4(-1.0f);
+	std::vector<glm::vec4> controls;
+	
+	// When set, the frame is only a tile of an image this large
+	glm::ivec2 virtual_size = glm::ivec2(0);
+	glm::ivec2 tile_origin = glm::ivec2(0);
+	
+	// Sub-pixel offset of the samples, in pixels
+	glm::vec2 jitter = glm::vec2(0.0f);
+	
+	bool redraw = true;
+	int refine_frames = 0;
+	int downscale = 1;
+	float uniform_ms = 0.0f;
+	
+	renderer(const renderer &) = delete;
+	renderer &operator=(const renderer &) = delete;
+	
+	renderer(const std::string &path, const std::vector<texture> &tex) :
+		shader_path(path),
+		textures(tex)
+	{
+		glCreateVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glDisable(GL_DEPTH_TEST);
+		
+		interleaved = std::make_unique<interleaved_renderer>();
+		present_program = make_present_program();
+	}
+	
+	~renderer()
+	{
+		ab.reset();
+		program.reset();
+		heatmap.reset();
+		interleaved.reset();
+		present_program.reset();
+		glDeleteVertexArrays(1, &vao);
+	}
+	
+	void reload()
+	{
+		trace_scope scope("reload");
+		try
+		{
+			// The program being replaced is kept around for comparison
+			auto next = make_program(shader_path, textures.size(), &reload_time);
+			reload_pending = program && reload_time.detected > 0.0;
+			if (program)
+				ab = std::make_unique<ab_comparison>(std::move(program), info, controls);
+			program = std::move(next);
+			inputs = shader_inputs(*program);
+			interleaved->invalidate();
+			if (heatmap) heatmap->reset();
+			controls.clear();
+			redraw = true;
+			
+			auto new_info = std::make_shared<program_info>();
+			new_info->serial = ++program_serial;
+			new_info->inputs = inputs;
+			new_info->source = program->source;
+			for (const auto &[name, unif] : program->uniforms)
+			{
+				if (name.find("ctl_") != 0) continue;
+				
+				control_info ctl{name, name.substr(4), unif.location, unif.type, glm::vec4(0.0f)};
+				if (unif.type == GL_INT || unif.type == GL_BOOL)
+				{
+					GLint value;
+					glGetUniformiv(program->id, unif.location, &value);
+					ctl.initial.x = value;
+				}
+				else if (unif.type == GL_FLOAT || unif.type == GL_FLOAT_VEC3 || unif.type == GL_FLOAT_VEC4)
+					glGetUniformfv(program->id, unif.location, &ctl.initial[0]);
+				else
+					continue;
+				
+				new_info->controls.push_back(ctl);
+			}
+			info = new_info;
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Loading shader failed!" << std::endl;
+			std::cerr << ex.what() << std::endl;
+		}
+		
+		shader_start_time = get_time();
+	}
+	
+	// Picks up the request and tells whether the shader has to be rendered again
+	bool update(const frame_request &req, const input_sample &input)
+	{
+		if (req.shader_generation != shader_generation)
+		{
+			shader_generation = req.shader_generation;
+			reload_time = reload_timing();
+			reload_time.saved = req.shader_saved;
+			reload_time.detected = req.shader_detected;
+			reload();
+		}
+		
+		if (req.width != width || req.height != height)
+		{
+			width = req.width;
+			height = req.height;
+			if (heatmap) heatmap->reset();
+			redraw = true;
+		}
+		
+		if (req.mode != interleaved->mode)
+		{
+			interleaved->set_mode(req.mode);
+			if (heatmap) heatmap->reset();
+			redraw = true;
+		}
+		
+		// Tiles are roughly square
+		if (req.heatmap_columns > 0 && width > 0 && height > 0)
+		{
+			if (!heatmap) heatmap = std::make_unique<cost_heatmap>();
+			heatmap->resize(req.heatmap_columns, std::max(1, req.heatmap_columns * height / width));
+			interleaved->heatmap = heatmap.get();
+		}
+		else if (heatmap)
+		{
+			heatmap.reset();
+			interleaved->heatmap = nullptr;
+			redraw = true;
+		}
+		
+		// Values are only meaningful for the program they were gathered for
+		if (info && req.program_serial == info->serial && req.controls != controls)
+		{
+			controls = req.controls;
+			redraw = true;
+		}
+		
+		// Mouse only matters when the shader reads it
+		if (inputs.mouse && input.mouse != mouse)
+			redraw = true;
+		
+		// The heatmap needs a steady stream of frames to average
+		return program && width > 0 && height > 0 && (redraw || heatmap || ab || inputs.animated() || (refine_frames > 0 && !req.interacting));
+	}
+	
+	// The input is latched into the pacer's buffer as the last thing before the pass
+	void draw(const frame_request &req, const input_sample &input, double time, frame_pacer &pacer)
+	{
+		double uniform_start = get_time();
+		glm::ivec2 resolution = virtual_size.x > 0 ? virtual_size : glm::ivec2(width, height);
+		set_uniforms(*program, info.get(), controls, resolution);
+		uniform_ms = (get_time() - uniform_start) * 1000.0;
+		
+		// Coarse preview while editing, then refined by halving the scale every frame
+		downscale = req.interacting ? req.preview_downscale : std::max(downscale / 2, 1);
+		mouse = input.mouse;
+		pacer.latch(input, time);
+		output = &interleaved->render(*program, width, height, downscale, glm::vec2(tile_origin) + jitter);
+		if (reload_pending && reload_time.drawn == 0.0)
+			reload_time.drawn = get_time();
+		if (heatmap)
+			heatmap->collect();
+		if (ab)
+			compare(req, resolution);
+		
+		// Reconstruction needs a few more frames to cover every pixel
+		if (downscale > 1)
+			refine_frames = interleaved->phase_count();
+		else if (redraw)
+			refine_frames = interleaved->phase_count() - 1;
+		else if (refine_frames > 0)
+			refine_frames--;
+		
+		redraw = false;
+		frame_counter++;
+	}
+	
+	// Sets up a program's uniforms and binds the textures for its pass
+	void set_uniforms(const shader_program &prog, const program_info *prog_info, const std::vector<glm::vec4> &values, glm::ivec2 resolution)
+	{
+		glUseProgram(prog.id);
+		dispatch_uniforms(prog, prog_info->controls, values, textures, resolution, frame_counter);
+	}
+	
+	/*
+		Times both versions of the shader at full resolution, with the
+		latched input of this frame. Waits for the GUI to send the new
+		program's controls, so both get the same values. Which one goes
+		first alternates, so neither always gets a warm cache.
+	*/
+	void compare(const frame_request &req, glm::ivec2 resolution)
+	{
+		if (req.program_serial != info->serial) return;
+		
+		for (int k = 0; k < 2; k++)
+		{
+			int which = k ^ (ab->frames & 1);
+			if (which == 0)
+				set_uniforms(*ab->baseline, ab->baseline_info.get(), ab->baseline_controls, resolution);
+			else
+				set_uniforms(*program, info.get(), controls, resolution);
+			ab->time_pass(which == 0 ? *ab->baseline : *program, which, width, height);
+		}
+		
+		if (++ab->frames >= ab_comparison::calibration_frames)
+		{
+			comparison = ab->result();
+			ab.reset();
+		}
+	}
+	
+	// Shows the last rendered output in the default framebuffer
+	void present()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, width, height);
+		glClear(GL_COLOR_BUFFER_BIT);
+		if (output)
+			::present(*output, *present_program, width, height);
+		if (output && heatmap)
+			heatmap->draw_overlay();
+	}
+};
+
+/*
+	All GL submission happens here. The thread takes over the window's
+	context and only exchanges data with the main thread through the link.
+*/
+void render_thread(GLFWwindow *win, render_link &link, const std::string &shader_path, const std::vector<texture> &textures)
+{
+	glfwMakeContextCurrent(win);
+	trace.name_thread("render");
+	
+	{
+		renderer r(shader_path, textures);
+		frame_pacer pacer;
+		stage_timer stages;
+		bool relative_timing = !timer_queries_cover_draws();
+		frame_profile &profile = link.profile;
+		double last_frame_time = get_time();
+		float frame_ms = 0.0f;
+		reload_timing reloads[render_status::reload_history];
+		int reload_count = 0;
+		
+		while (!link.quit)
+		{
+			bool fresh = link.requests.update();
+			frame_request &req = link.requests.read_buffer();
+			link.inputs.update();
+			bool draw_shader = r.update(req, link.inputs.read_buffer());
+			
+			// Nothing new to show - sleep until the main thread sends something
+			if (!fresh && !draw_shader)
+			{
+				link.wake.wait(0.1);
+				continue;
+			}
+			
+			// This may wait for the GPU, so the input is sampled again only after it
+			uint64_t frame_allocations = allocation_count;
+			trace_scope frame_scope("frame");
+			pacer.set_frames_in_flight(req.frames_in_flight);
+			{
+				trace_scope scope("wait for GPU");
+				pacer.begin_frame();
+			}
+			
+			stages.begin_frame();
+			double draw_start = get_time();
+			if (draw_shader)
+			{
+				link.inputs.update();
+				r.draw(req, link.inputs.read_buffer(), get_time() - r.shader_start_time, pacer);
+				profile.cpu_uniforms.push(r.uniform_ms);
+			}
+			double draw_end = get_time();
+			profile.cpu_draw.push((draw_end - draw_start) * 1000.0);
+			trace.record("draw", draw_start, draw_end - draw_start);
+			stages.mark();
+			
+			{
+				trace_scope scope("present");
+				r.present();
+				stages.mark();
+				ImGui_ImplOpenGL3_NewFrame();
+				ImGui_ImplOpenGL3_RenderDrawData(&req.gui.data);
+				stages.mark();
+			}
+			
+			double swap_start = get_time();
+			glfwSwapBuffers(win);
+			double swap_end = get_time();
+			profile.cpu_swap.push((swap_end - swap_start) * 1000.0);
+			trace.record("swap", swap_start, swap_end - swap_start);
+			
+			// An edit is complete once the first frame showing it is swapped
+			if (r.reload_pending && r.reload_time.drawn > 0.0)
+			{
+				r.reload_pending = false;
+				r.reload_time.swapped = swap_end;
+				
+				char line[160];
+				r.reload_time.format(line, sizeof(line));
+				std::cerr << "Reloaded '" << shader_path << "' in " << line << std::endl;
+				
+				if (reload_count == render_status::reload_history)
+					std::rotate(reloads, reloads + 1, reloads + reload_count--);
+				reloads[reload_count++] = r.reload_time;
+			}
+			stages.mark();
+			stages.end_frame();
+			pacer.end_frame();
+			
+			// Marks are: frame start, pass, present, GUI, swap
+			static const char *const gpu_stages[] = {"shader pass", "present", "GUI render", "swap"};
+			stages.collect([&](const double *times, int count)
+			{
+				if (count < 5) return;
+				profile_series *series[] = {&profile.gpu_pass, &profile.gpu_present, &profile.gpu_gui, &profile.gpu_swap};
+				for (int i = 0; i < 4; i++)
+				{
+					series[i]->push((times[i + 1] - times[i]) * 1000.0);
+					trace.record(gpu_stages[i], times[i], times[i + 1] - times[i], tracer::gpu_track);
+				}
+				profile.gpu_frame.push((times[4] - times[0]) * 1000.0);
+			});
+			
+			double now = get_time();
+			frame_ms = frame_ms * 0.9f + (now - last_frame_time) * 100.0f;
+			profile.cpu_frame.push((now - last_frame_time) * 1000.0);
+			last_frame_time = now;
+			
+			render_status &status = link.status.write_buffer();
+			status.program = r.info;
+			status.frame_ms = frame_ms;
+			float latch_max_ms;
+			pacer.stats(pacer.latch_history, status.latch_ms, latch_max_ms);
+			pacer.stats(pacer.latency_history, status.latency_ms, status.latency_max_ms);
+			status.heatmap_max_ms = r.heatmap ? r.heatmap->max_cost() : 0.0f;
+			status.heatmap_total_ms = r.heatmap ? std::accumulate(r.heatmap->costs.begin(), r.heatmap->costs.end(), 0.0f) : 0.0f;
+			status.comparing = r.ab != nullptr;
+			status.relative_timing = relative_timing;
+			status.comparison = r.comparison;
+			std::copy(reloads, reloads + reload_count, status.reloads);
+			status.reload_count = reload_count;
+			link.status.publish();
+			profile.render_allocations.push(allocation_count - frame_allocations);
+		}
+	}
+	
+	glfwMakeContextCurrent(nullptr);
+}
+
+// Seconds since the epoch, as precise as the file system keeps it
+double get_mod_time(const std::string &path)
+{
+	struct stat result;
+	if (stat(path.c_str(), &result) == 0)
+		return result.st_mtim.tv_sec + result.st_mtim.tv_nsec * 1e-9;
+	else
+		throw std::runtime_error("could not get modification time");
+}
+
+/*
+	Messages from the GL debug output in diagnostics mode. A repeated
+	message only bumps its count and new messages beyond a few per second
+	are dropped, so a driver warning on every draw can't flood the log.
+*/
+struct gl_debug_log
+{
+	static constexpr int max_entries = 64;
+	static constexpr int max_per_second = 10;
+	
+	struct entry
+	{
+		GLenum source;
+		GLenum type;
+		GLuint id;
+		std::string message;
+		long count;
+	};
+	
+	std::mutex mutex;
+	std::vector<entry> entries;
+	long dropped = 0;
+	double window_start = 0.0;
+	int window_count = 0;
+	
+	void add(GLenum source, GLenum type, GLuint id, const char *message)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (entry &e : entries)
+			if (e.source == source && e.type == type && e.id == id && e.message == message)
+			{
+				e.count++;
+				return;
+			}
+		
+		double now = get_time();
+		if (now - window_start >= 1.0)
+		{
+			window_start = now;
+			window_count = 0;
+		}
+		
+		if (window_count >= max_per_second || entries.size() >= max_entries)
+		{
+			dropped++;
+			return;
+		}
+		
+		window_count++;
+		entries.push_back({source, type, id, message, 1});
+		
+		// Performance warnings are for the GUI, anything else is likely a bug
+		if (type != GL_DEBUG_TYPE_PERFORMANCE)
+			std::cerr << "GL " << type_name(type) << ": " << message << std::endl;
+	}
+	
+	static const char *type_name(GLenum type)
+	{
+		switch (type)
+		{
+			case GL_DEBUG_TYPE_ERROR: return "error";
+			case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+			case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+			case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+			case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+			default: return "other";
+		}
+	}
+};
+
+gl_debug_log debug_log;
+
+void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *user)
+{
+	if (severity != GL_DEBUG_SEVERITY_NOTIFICATION)
+		debug_log.add(source, type, id, message);
+}
+
+// Synchronous, so the callback runs on the thread that made the offending call
+void enable_gl_diagnostics()
+{
+	glEnable(GL_DEBUG_OUTPUT);
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(gl_debug_callback, nullptr);
+}
+
+/*
+	Surfaceless EGL context, for rendering without a window or an X server.
+	Unless diagnosing, it's a no-error context where the driver supports it.
+*/
+struct egl_context
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	
+	egl_context(const egl_context &) = delete;
+	egl_context &operator=(const egl_context &) = delete;
+	
+	explicit egl_context(bool diagnostics = false)
+	{
+		auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (get_platform_display)
+			display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+			throw std::runtime_error("could not initialize EGL display");
+		
+		const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+		bool no_error = !diagnostics && extensions && std::strstr(extensions, "EGL_KHR_create_context_no_error");
+		EGLint attribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 5,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE, EGL_NONE,
+			EGL_NONE
+		};
+		
+		// Without the extension, the attribute itself is an error
+		if (diagnostics || no_error)
+		{
+			attribs[6] = diagnostics ? EGL_CONTEXT_OPENGL_DEBUG : EGL_CONTEXT_OPENGL_NO_ERROR_KHR;
+			attribs[7] = EGL_TRUE;
+		}
+		
+		if (eglBindAPI(EGL_OPENGL_API))
+			context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+			eglTerminate(display);
+			throw std::runtime_error("could not create surfaceless OpenGL 4.5 context");
+		}
+	}
+	
+	~egl_context()
+	{
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display, context);
+		eglTerminate(display);
+	}
+};
+
+// A surfaceless context with GLEW loaded, for everything that runs without a window
+struct headless_gl
+{
+	egl_context egl;
+	
+	explicit headless_gl(bool diagnostics) :
+		egl(diagnostics)
+	{
+		// glewInit() would also want a GLX display, which there isn't
+		glewExperimental = GL_TRUE;
+		if (glewContextInit() != GLEW_OK) throw std::runtime_error("glewContextInit() failed");
+		if (diagnostics)
+			enable_gl_diagnostics();
+	}
+};
+
+/*
+	Expands the frame number in an output pattern like frame_%05d.png. Only
+	a single %d (or %i) with an optional 0 flag and width is understood,
+	and %% is a percent sign. A pattern without a conversion is a plain
+	file name.
+*/
+std::string frame_path(const std::string &pattern, long frame)
+{
+	std::string path;
+	int conversions = 0;
+	for (size_t i = 0; i < pattern.size(); i++)
+	{
+		if (pattern[i] != '%')
+		{
+			path += pattern[i];
+			continue;
+		}
+		
+		if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+		{
+			path += '%';
+			i++;
+			continue;
+		}
+		
+		size_t j = i + 1;
+		bool zero = j < pattern.size() && pattern[j] == '0';
+		size_t width = 0;
+		for (j += zero; j < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[j])) && width <= 64; j++)
+			width = width * 10 + (pattern[j] - '0');
+		if (j == pattern.size() || (pattern[j] != 'd' && pattern[j] != 'i') || width > 64 || conversions++)
+			throw std::runtime_error("output pattern '"s + pattern + "' should have a single %d, like %05d, and %% for a percent sign"s);
+		
+		std::string digits = std::to_string(frame < 0 ? -frame : frame), sign = frame < 0 ? "-" : "";
+		size_t pad = width > digits.size() + sign.size() ? width - digits.size() - sign.size() : 0;
+		path += zero ? sign + std::string(pad, '0') + digits : std::string(pad, ' ') + sign + digits;
+		i = j;
+	}
+	return path;
+}
+
+// Blocks the pusher while full and the popper while empty
+template <typename T>
+struct bounded_queue
+{
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<T> items;
+	size_t capacity;
+	bool closed = false;
+	
+	explicit bounded_queue(size_t cap) :
+		capacity(cap)
+	{
+	}
+	
+	void push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [&]{ return items.size() < capacity || closed; });
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+	}
+	
+	// Returns false once the queue is closed and empty
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [&]{ return !items.empty() || closed; });
+		if (items.empty()) return false;
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+	
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+};
+
+// glClientWaitSync() cannot wait forever in one go
+void wait_fence(GLsync fence)
+{
+	while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+}
+
+enum class export_format
+{
+	png,
+	y4m,
+	raw,
+	nv12,
+};
+
+const char *format_name(export_format format)
+{
+	switch (format)
+	{
+		case export_format::y4m: return "y4m";
+		case export_format::raw: return "raw";
+		case export_format::nv12: return "nv12";
+		default: return "png";
+	}
+}
+
+export_format parse_format(const std::string &name)
+{
+	for (auto format : {export_format::png, export_format::y4m, export_format::raw, export_format::nv12})
+		if (name == format_name(format))
+			return format;
+	throw std::runtime_error("unknown format '"s + name + "' - expected png, y4m, raw or nv12"s);
+}
+
+// FNV-1a, to tell whether frames from different runs are identical
+uint64_t hash_bytes(const uint8_t *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	return hash;
+}
+
+/*
+	Averages sub-frames into a float buffer on the GPU. Spread over the
+	shutter interval and jittered within the pixel, they give exported
+	frames motion blur and antialiasing.
+*/
+struct accumulator
+{
+	std::unique_ptr<shader_program> program;
+	std::unique_ptr<render_target> sum;
+	
+	accumulator(const accumulator &) = delete;
+	accumulator &operator=(const accumulator &) = delete;
+	
+	accumulator() :
+		program(make_present_program())
+	{
+	}
+	
+	void clear(int width, int height)
+	{
+		if (!sum || sum->width != width || sum->height != height)
+			sum = std::make_unique<render_target>(width, height, GL_RGBA32F);
+		
+		static const float zero[4] = {};
+		glClearNamedFramebufferfv(sum->fbo, GL_COLOR, 0, zero);
+	}
+	
+	void add(const render_target &image, float weight)
+	{
+		sum->bind();
+		glUseProgram(program->id);
+		glBindTextureUnit(0, image.tex);
+		glEnable(GL_BLEND);
+		glBlendColor(0.0f, 0.0f, 0.0f, weight);
+		glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glDisable(GL_BLEND);
+	}
+};
+
+// Radical inverse - a well spread, repeatable sequence in [0, 1)
+float halton(int index, int base)
+{
+	float result = 0.0f;
+	for (float f = 1.0f / base; index > 0; index /= base, f /= base)
+		result += f * (index % base);
+	return result;
+}
+
+/*
+	Turns the rendered image into exactly the bytes that end up in the
+	output file, so nothing is left to do on the CPU but compression.
+	Every plane is an R8 target holding top-down rows: packed RGB for
+	PNG and raw output, I420 for y4m and NV12 for raw YUV. Optionally
+	the image is box filtered down by an integer factor first.
+	
+	Each plane gets its own program with the mode and the scale baked
+	in, so there is no branching on uniforms per pixel.
+*/
+struct frame_converter
+{
+	std::vector<std::unique_ptr<shader_program>> programs;
+	std::vector<std::unique_ptr<render_target>> planes;
+	int scale;
+	int width;
+	int height;
+	size_t frame_size = 0;
+	
+	frame_converter(const frame_converter &) = delete;
+	frame_converter &operator=(const frame_converter &) = delete;
+	
+	frame_converter(export_format format, int source_width, int source_height, int downscale) :
+		scale(downscale),
+		width(source_width / downscale),
+		height(source_height / downscale)
+	{
+		int cw = (width + 1) / 2;
+		int ch = (height + 1) / 2;
+		switch (format)
+		{
+			case export_format::png:
+			case export_format::raw:
+				add_plane(0, width * 3, height);
+				break;
+			
+			case export_format::y4m:
+				add_plane(1, width, height);
+				add_plane(2, cw, ch);
+				add_plane(3, cw, ch);
+				break;
+			
+			case export_format::nv12:
+				add_plane(1, width, height);
+				add_plane(4, cw * 2, ch);
+				break;
+		}
+	}
+	
+	void add_plane(int mode, int w, int h)
+	{
+		static const std::string source = 
+		"layout (binding = 0) uniform sampler2D image;"
+		"layout (location = 0) uniform ivec2 size;"
+		"out vec4 f_color;"
+		
+		// Output pixel p, counted from the top
+		"vec3 rgb(ivec2 p)"
+		"{"
+		"	p = clamp(p, ivec2(0), size - 1);"
+		"	ivec2 base = ivec2(p.x, size.y - 1 - p.y) * SCALE;"
+		"	vec3 sum = vec3(0.0);"
+		"	for (int y = 0; y < SCALE; y++)"
+		"		for (int x = 0; x < SCALE; x++)"
+		"			sum += texelFetch(image, base + ivec2(x, y), 0).rgb;"
+		"	return sum / float(SCALE * SCALE);"
+		"}"
+		
+		// BT.601 full range
+		"float chroma(ivec2 p, int channel)"
+		"{"
+		"	p *= 2;"
+		"	vec3 c = (rgb(p) + rgb(p + ivec2(1, 0)) + rgb(p + ivec2(0, 1)) + rgb(p + ivec2(1, 1))) * 0.25;"
+		"	return dot(c, channel == 0 ? vec3(-0.168736, -0.331264, 0.5) : vec3(0.5, -0.418688, -0.081312)) + 0.5;"
+		"}"
+		
+		"void main()"
+		"{"
+		"	ivec2 p = ivec2(gl_FragCoord.xy);\n"
+		"#if MODE == 0\n"
+		"	f_color = vec4(rgb(ivec2(p.x / 3, p.y))[p.x % 3]);\n"
+		"#elif MODE == 1\n"
+		"	f_color = vec4(dot(rgb(p), vec3(0.299, 0.587, 0.114)));\n"
+		"#elif MODE == 4\n"
+		"	f_color = vec4(chroma(ivec2(p.x / 2, p.y), p.x % 2));\n"
+		"#else\n"
+		"	f_color = vec4(chroma(p, MODE - 2));\n"
+		"#endif\n"
+		"}";
+		
+		std::string defines = "#version 430 core\n#define MODE "s + std::to_string(mode) + "\n#define SCALE "s + std::to_string(scale) + "\n"s;
+		programs.push_back(make_builtin_program(defines + source));
+		planes.push_back(std::make_unique<render_target>(w, h, GL_R8));
+		frame_size += size_t(w) * h;
+	}
+	
+	void convert(const render_target &image)
+	{
+		glBindTextureUnit(0, image.tex);
+		for (size_t i = 0; i < planes.size(); i++)
+		{
+			planes[i]->bind();
+			glUseProgram(programs[i]->id);
+			glUniform2i(0, width, height);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		}
+	}
+	
+	// Reads the planes back to back into the bound pixel pack buffer
+	void read() const
+	{
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		size_t offset = 0;
+		for (const auto &plane : planes)
+		{
+			size_t size = size_t(plane->width) * plane->height;
+			glGetTextureImage(plane->tex, 0, GL_RED, GL_UNSIGNED_BYTE, size, reinterpret_cast<void*>(offset));
+			offset += size;
+		}
+	}
+};
+
+/*
+	Reads frames back through a ring of pixel pack buffers. A frame is
+	only mapped once the ring is full, so by then the GPU has long
+	finished it and the copy doesn't stall rendering.
+*/
+struct async_readback
+{
+	struct slot
+	{
+		GLuint pbo;
+		GLsync fence = nullptr;
+		long frame = 0;
+	};
+	
+	size_t frame_size;
+	std::vector<slot> slots;
+	int head = 0;
+	int pending = 0;
+	
+	async_readback(const async_readback &) = delete;
+	async_readback &operator=(const async_readback &) = delete;
+	
+	async_readback(size_t size, int depth) :
+		frame_size(size),
+		slots(depth)
+	{
+		for (auto &s : slots)
+		{
+			glCreateBuffers(1, &s.pbo);
+			glNamedBufferStorage(s.pbo, frame_size, nullptr, GL_MAP_READ_BIT);
+		}
+	}
+	
+	~async_readback()
+	{
+		for (auto &s : slots)
+		{
+			if (s.fence) glDeleteSync(s.fence);
+			glDeleteBuffers(1, &s.pbo);
+		}
+	}
+	
+	bool full() const
+	{
+		return pending == int(slots.size());
+	}
+	
+	// Queues a copy of the converted frame - the ring must not be full
+	void issue(const frame_converter &converter, long frame)
+	{
+		slot &s = slots[(head + pending++) % slots.size()];
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		converter.read();
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		s.frame = frame;
+	}
+	
+	// Hands the oldest frame to consume(frame, data) while it's mapped
+	template <typename F>
+	void collect(F &&consume)
+	{
+		slot &s = slots[head];
+		wait_fence(s.fence);
+		glDeleteSync(s.fence);
+		s.fence = nullptr;
+		
+		auto data = static_cast<const uint8_t*>(glMapNamedBufferRange(s.pbo, 0, frame_size, GL_MAP_READ_BIT));
+		consume(s.frame, data);
+		glUnmapNamedBuffer(s.pbo);
+		head = (head + 1) % slots.size();
+		pending--;
+	}
+};
+
+/*
+	Writes converted frames out on a pool of worker threads. PNG frames
+	are compressed in parallel and go to separate files in any order,
+	y4m and raw frames are appended to a single stream (a file or
+	stdout) in the order they were submitted. A hash of every frame is
+	kept for the manifest.
+	
+	There is a fixed number of frame buffers - when all of them are
+	queued or being written, acquire() blocks and rendering waits.
+*/
+struct frame_exporter
+{
+	static constexpr const char *frame_tag = "FRAME\n";
+	
+	struct job
+	{
+		long sequence;
+		long frame;
+		std::vector<uint8_t> pixels;
+	};
+	
+	export_format format;
+	std::string output;
+	int width;
+	int height;
+	FILE *stream = nullptr;
+	size_t header_size = 0;
+	
+	std::vector<std::unique_ptr<job>> jobs;
+	bounded_queue<job*> queued;
+	bounded_queue<job*> free_jobs;
+	std::vector<std::thread> workers;
+	
+	// Stream output order
+	std::mutex write_mutex;
+	std::map<long, job*> ready;
+	long next_sequence = 0;
+	std::map<long, uint64_t> hashes;
+	std::exception_ptr error;
+	
+	frame_exporter(const frame_exporter &) = delete;
+	frame_exporter &operator=(const frame_exporter &) = delete;
+	
+	// When resuming, the stream is cut back to where the checkpoint was taken
+	frame_exporter(export_format fmt, const std::string &path, int w, int h, double fps, int threads, const checkpoint *resume = nullptr) :
+		format(fmt),
+		output(path),
+		width(w),
+		height(h),
+		queued(threads * 2),
+		free_jobs(threads * 2)
+	{
+		if (format != export_format::png)
+		{
+			if (path == "-")
+				stream = stdout;
+			else if (resume)
+			{
+				stream = std::fopen(path.c_str(), "r+b");
+				if (stream && (ftruncate(fileno(stream), resume->stream_size) || fseeko(stream, resume->stream_size, SEEK_SET)))
+					throw std::runtime_error("could not resume writing '"s + path + "'"s);
+			}
+			else
+				stream = std::fopen(path.c_str(), "wb");
+			
+			if (!stream)
+				throw std::runtime_error("could not open '"s + path + "' for writing"s);
+		}
+		
+		if (format == export_format::y4m)
+		{
+			char header[256];
+			header_size = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width, height, std::lround(fps * 1000.0));
+			if (!resume)
+				std::fputs(header, stream);
+		}
+		
+		if (resume)
+		{
+			next_sequence = resume->next;
+			hashes = resume->hashes;
+		}
+		
+		for (int i = 0; i < threads * 2; i++)
+		{
+			jobs.push_back(std::make_unique<job>());
+			free_jobs.push(jobs.back().get());
+		}
+		
+		for (int i = 0; i < threads; i++)
+			workers.emplace_back(&frame_exporter::work, this);
+	}
+	
+	~frame_exporter()
+	{
+		queued.close();
+		for (auto &t : workers)
+			if (t.joinable()) t.join();
+		if (stream && stream != stdout) std::fclose(stream);
+	}
+	
+	// Blocks until a frame buffer is free
+	job &acquire()
+	{
+		job *j;
+		free_jobs.pop(j);
+		
+		std::lock_guard<std::mutex> lock(write_mutex);
+		if (error) std::rethrow_exception(error);
+		return *j;
+	}
+	
+	void submit(job &j)
+	{
+		queued.push(&j);
+	}
+	
+	// Waits until everything submitted is on disk and returns the stream size
+	uint64_t sync()
+	{
+		std::vector<job*> idle(jobs.size());
+		for (auto &j : idle)
+			free_jobs.pop(j);
+		for (auto j : idle)
+			free_jobs.push(j);
+		
+		std::lock_guard<std::mutex> lock(write_mutex);
+		if (error) std::rethrow_exception(error);
+		if (!stream) return 0;
+		if (std::fflush(stream) || (stream != stdout && fsync(fileno(stream))))
+			throw std::runtime_error("writing '"s + output + "' failed"s);
+		return ftello(stream);
+	}
+	
+	// Waits for all frames to be written
+	void finish()
+	{
+		queued.close();
+		for (auto &t : workers)
+			t.join();
+		if (stream) std::fflush(stream);
+		if (error) std::rethrow_exception(error);
+		if (stream && std::ferror(stream))
+			throw std::runtime_error("writing '"s + output + "' failed"s);
+	}
+	
+	void work()
+	{
+		trace.name_thread("export");
+		job *j;
+		while (queued.pop(j))
+		{
+			trace_scope scope("export frame");
+			uint64_t hash = hash_bytes(j->pixels.data(), j->pixels.size());
+			{
+				std::lock_guard<std::mutex> lock(write_mutex);
+				hashes[j->frame] = hash;
+			}
+			
+			if (stream)
+			{
+				write_in_order(j);
+				continue;
+			}
+			
+			try
+			{
+				png_writer png(frame_path(output, j->frame), width, height, 3);
+				png.write_rows(j->pixels.data(), height);
+				png.finish();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(write_mutex);
+				if (!error) error = std::current_exception();
+			}
+			free_jobs.push(j);
+		}
+	}
+	
+	// Whoever completes the next frame in line writes out everything that's ready
+	void write_in_order(job *j)
+	{
+		std::lock_guard<std::mutex> lock(write_mutex);
+		ready[j->sequence] = j;
+		for (auto it = ready.begin(); it != ready.end() && it->first == next_sequence; it = ready.erase(it), next_sequence++)
+		{
+			if (format == export_format::y4m)
+				std::fputs(frame_tag, stream);
+			std::fwrite(it->second->pixels.data(), 1, it->second->pixels.size(), stream);
+			free_jobs.push(it->second);
+		}
+	}
+};
+
+/*
+	Describes what a headless run, or one shard of it, has written: the
+	settings, and a hash of every frame. Manifests of all the shards are
+	enough to check the render is complete and to merge the streams into
+	what a single process would have written.
+*/
+struct export_manifest
+{
+	export_format format = export_format::png;
+	int width = 0;
+	int height = 0;
+	long first_frame = 0;
+	long last_frame = 0;
+	long frame_step = 1;
+	double time_step = 0.0;
+	int shard = 0;
+	int shard_count = 1;
+	std::string output;
+	
+	// Layout of y4m and raw streams, frames include the y4m FRAME tag
+	size_t header_size = 0;
+	size_t frame_size = 0;
+	
+	std::map<long, uint64_t> frames;
+	
+	bool same_render(const export_manifest &other) const
+	{
+		return format == other.format && width == other.width && height == other.height
+			&& first_frame == other.first_frame && last_frame == other.last_frame && frame_step == other.frame_step
+			&& time_step == other.time_step && shard_count == other.shard_count;
+	}
+	
+	// Written next to the final file and renamed, so it is never seen half-written
+	void write(const std::string &path) const
+	{
+		std::string temp_path = path + ".tmp"s;
+		{
+			std::ofstream f(temp_path);
+			f.precision(17);
+			f << "shaderdude-manifest 1\n";
+			f << "format " << format_name(format) << "\n";
+			f << "size " << width << " " << height << "\n";
+			f << "frames " << first_frame << " " << last_frame << " " << frame_step << "\n";
+			f << "time-step " << time_step << "\n";
+			f << "shard " << shard << " " << shard_count << "\n";
+			f << "stream " << header_size << " " << frame_size << "\n";
+			f << "output " << output << "\n";
+			
+			char hash[17];
+			for (const auto &[frame, h] : frames)
+			{
+				std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(h));
+				f << "frame " << frame << " " << hash << "\n";
+			}
+			
+			if (!f.flush())
+				throw std::runtime_error("could not write manifest '"s + temp_path + "'"s);
+		}
+		
+		if (std::rename(temp_path.c_str(), path.c_str()))
+			throw std::runtime_error("could not write manifest '"s + path + "'"s);
+	}
+	
+	static export_manifest read(const std::string &path)
+	{
+		std::ifstream f(path);
+		std::string line;
+		if (!f || !std::getline(f, line) || line != "shaderdude-manifest 1")
+			throw std::runtime_error("'"s + path + "' is not a shaderdude manifest"s);
+		
+		export_manifest m;
+		while (std::getline(f, line))
+		{
+			std::istringstream in(line);
+			std::string key;
+			in >> key;
+			
+			if (key == "format")
+			{
+				std::string name;
+				in >> name;
+				m.format = parse_format(name);
+			}
+			else if (key == "size") in >> m.width >> m.height;
+			else if (key == "frames") in >> m.first_frame >> m.last_frame >> m.frame_step;
+			else if (key == "time-step") in >> m.time_step;
+			else if (key == "shard") in >> m.shard >> m.shard_count;
+			else if (key == "stream") in >> m.header_size >> m.frame_size;
+			else if (key == "output") m.output = line.substr(7);
+			else if (key == "frame")
+			{
+				long frame;
+				std::string hash;
+				in >> frame >> hash;
+				m.frames[frame] = std::stoull(hash, nullptr, 16);
+			}
+			
+			if (in.fail())
+				throw std::runtime_error("malformed line in '"s + path + "': "s + line);
+		}
+		
+		return m;
+	}
+};
+
+// Values of a control in a --sweep, evenly spaced from first to last
+struct sweep_range
+{
+	std::string name;
+	double first;
+	double last;
+	int count;
+	
+	double value(int index) const
+	{
+		return count > 1 ? first + (last - first) * index / (count - 1) : first;
+	}
+};
+
+struct options
+{
+	std::string shader_path;
+	std::vector<std::string> texture_paths;
+	bool headless = false;
+	int width = 720;
+	int height = 480;
+	long first_frame = 0;
+	long last_frame = 0;
+	long frame_step = 1;
+	double time_step = 1.0 / 60.0;
+	int shard = 0;
+	int shard_count = 1;
+	std::vector<long> frames;
+	std::string output = "frame_%05d.png";
+	std::string manifest;
+	std::string checkpoint;
+	double checkpoint_interval = 60.0;
+	std::string trace;
+	bool merge = false;
+	std::vector<std::string> merge_manifests;
+	bool bench = false;
+	long bench_frames = 0;
+	double bench_seconds = 0.0;
+	long bench_warmup = 10;
+	bool check_allocations = false;
+	std::vector<sweep_range> sweeps;
+	double budget_ms = 0.0;
+	std::string characterize;
+	std::string compile_scaling;
+	bool diagnostics = false;
+	export_format format = export_format::png;
+	int scale = 1;
+	int tile_size = 0;
+	int samples = 1;
+	double shutter = 180.0;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+options parse_options(int argc, char *argv[])
+{
+	options opt;
+	std::vector<std::string> positional;
+	std::string format;
+	
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 >= argc) throw std::runtime_error("missing value for "s + arg);
+			return argv[++i];
+		};
+		
+		if (arg == "--headless")
+			opt.headless = true;
+		else if (arg == "--size")
+		{
+			if (std::sscanf(value().c_str(), "%dx%d", &opt.width, &opt.height) != 2 || opt.width <= 0 || opt.height <= 0)
+				throw std::runtime_error("--size expects WIDTHxHEIGHT");
+		}
+		else if (arg == "--frames")
+		{
+			std::string range = value();
+			int n = std::sscanf(range.c_str(), "%ld:%ld:%ld", &opt.first_frame, &opt.last_frame, &opt.frame_step);
+			if (n == 1) opt.last_frame = opt.first_frame;
+			if (n < 1 || opt.last_frame < opt.first_frame || opt.frame_step < 1)
+				throw std::runtime_error("--frames expects FIRST:LAST:STEP");
+		}
+		else if (arg == "--time-step")
+			opt.time_step = std::stod(value());
+		else if (arg == "--fps")
+			opt.time_step = 1.0 / std::stod(value());
+		else if (arg == "--shard")
+		{
+			if (std::sscanf(value().c_str(), "%d/%d", &opt.shard, &opt.shard_count) != 2 || opt.shard < 0 || opt.shard >= opt.shard_count)
+				throw std::runtime_error("--shard expects INDEX/COUNT");
+		}
+		else if (arg == "--manifest")
+			opt.manifest = value();
+		else if (arg == "--checkpoint")
+			opt.checkpoint = value();
+		else if (arg == "--checkpoint-interval")
+			opt.checkpoint_interval = std::stod(value());
+		else if (arg == "--merge")
+			opt.merge = true;
+		else if (arg == "--bench")
+		{
+			std::string length = value();
+			opt.bench = true;
+			if (!length.empty() && length.back() == 's')
+				opt.bench_seconds = std::stod(length);
+			else
+				opt.bench_frames = std::max(1L, std::stol(length));
+		}
+		else if (arg == "--warmup")
+			opt.bench_warmup = std::max(0L, std::stol(value()));
+		else if (arg == "--check-allocations")
+			opt.check_allocations = true;
+		else if (arg == "--sweep")
+		{
+			std::string spec = value();
+			size_t eq = spec.find('=');
+			sweep_range range{spec.substr(0, eq), 0.0, 0.0, 0};
+			if (eq == std::string::npos || std::sscanf(spec.c_str() + eq + 1, "%lf:%lf:%d", &range.first, &range.last, &range.count) != 3 || range.count < 1)
+				throw std::runtime_error("--sweep expects NAME=FIRST:LAST:COUNT");
+			opt.sweeps.push_back(range);
+		}
+		else if (arg == "--budget")
+			opt.budget_ms = std::stod(value());
+		else if (arg == "--characterize")
+			opt.characterize = value();
+		else if (arg == "--compile-scaling")
+			opt.compile_scaling = value();
+		else if (arg == "--diagnostics")
+			opt.diagnostics = true;
+		else if (arg == "--output")
+			opt.output = value();
+		else if (arg == "--format")
+			format = value();
+		else if (arg == "--scale")
+			opt.scale = std::max(1, std::stoi(value()));
+		else if (arg == "--samples")
+			opt.samples = std::max(1, std::stoi(value()));
+		else if (arg == "--shutter")
+			opt.shutter = std::clamp(std::stod(value()), 0.0, 360.0);
+		else if (arg == "--tile")
+			opt.tile_size = std::max(1, std::stoi(value()));
+		else if (arg == "--threads")
+			opt.threads = std::max(1, std::stoi(value()));
+		else if (arg == "--trace")
+			opt.trace = value();
+		else if (arg.rfind("--", 0) == 0)
+			throw std::runtime_error("unknown option '"s + arg + "'"s);
+		else
+			positional.push_back(arg);
+	}
+	
+	// Nothing to render, the shaders are built in
+	if (!opt.characterize.empty() || !opt.compile_scaling.empty())
+		return opt;
+	
+	if (!opt.sweeps.empty() && !opt.bench)
+		throw std::runtime_error("--sweep needs --bench");
+	
+	if (positional.empty())
+		throw std::runtime_error(opt.merge ? "no manifests given" : "no shader file given");
+	
+	// Without --format, the output file extension decides
+	auto ends_with = [&](const char *ext){ return opt.output.size() >= std::strlen(ext) && opt.output.compare(opt.output.size() - std::strlen(ext), std::string::npos, ext) == 0; };
+	if (format.empty())
+		format = ends_with(".y4m") ? "y4m" : ends_with(".rgb") || ends_with(".raw") ? "raw" : ends_with(".nv12") || ends_with(".yuv") ? "nv12" : "png";
+	
+	opt.format = parse_format(format);
+	
+	if (opt.width < opt.scale || opt.height < opt.scale)
+		throw std::runtime_error("--scale is larger than the image");
+	
+	if (!opt.checkpoint.empty() && opt.output == "-" && opt.format != export_format::png)
+		throw std::runtime_error("output to a pipe can't be resumed from a checkpoint");
+	
+	// Each shard takes a contiguous run of the frames
+	long count = (opt.last_frame - opt.first_frame) / opt.frame_step + 1;
+	for (long i = count * opt.shard / opt.shard_count; i < count * (opt.shard + 1) / opt.shard_count; i++)
+		opt.frames.push_back(opt.first_frame + i * opt.frame_step);
+	
+	// Every frame needs a file of its own
+	if (opt.headless && opt.format == export_format::png && frame_path(opt.output, 0) == frame_path(opt.output, 1) && count > 1)
+		throw std::runtime_error("output pattern '"s + opt.output + "' has no %d for the frame number"s);
+	
+	if (opt.merge)
+		opt.merge_manifests = positional;
+	else
+	{
+		opt.shader_path = positional[0];
+		opt.texture_paths.assign(positional.begin() + 1, positional.end());
+	}
+	return opt;
+}
+
+std::vector<texture> load_textures(const std::vector<std::string> &paths)
+{
+	std::vector<texture> textures;
+	for (const auto &path : paths)
+		textures.emplace_back(path);
+	return textures;
+}
+
+/*
+	Renders one exported frame, or with more than one sample, averages
+	sub-frames spread over the time the shutter is open, starting at
+	the frame's time. Each sub-frame gets its own input slot, so the GPU
+	sees every sub-frame's iTime.
+*/
+const render_target &render_frame(renderer &r, frame_pacer &pacer, accumulator &acc, const frame_request &req, const options &opt, long frame)
+{
+	trace_scope scope("render frame");
+	input_sample input;
+	for (int k = 0; k < opt.samples; k++)
+	{
+		double time = frame * opt.time_step;
+		if (opt.samples > 1)
+		{
+			time += opt.time_step * opt.shutter / 360.0 * (k + 0.5) / opt.samples;
+			r.jitter = glm::vec2(halton(k + 1, 2) - 0.5f, halton(k + 1, 3) - 0.5f);
+		}
+		
+		pacer.begin_frame();
+		r.frame_counter = frame;
+		r.draw(req, input, time, pacer);
+		if (opt.samples > 1)
+		{
+			if (k == 0) acc.clear(r.output->width, r.output->height);
+			acc.add(*r.output, 1.0f / opt.samples);
+		}
+		pacer.end_frame();
+	}
+	
+	return opt.samples > 1 ? *acc.sum : *r.output;
+}
+
+/*
+	Renders every frame as a grid of tiles, each one a window into the
+	full size image, and streams the rows of each finished strip of tiles
+	to the PNG file. Only one strip is ever held in memory, so posters can
+	be far larger than the GPU could render in one pass.
+*/
+template <typename F>
+void render_tiled(renderer &r, frame_pacer &pacer, const options &opt, int tile_size, export_manifest &manifest, long first, F &&frame_done)
+{
+	// Tiles must cover whole output pixels
+	tile_size = std::max(tile_size / opt.scale, 1) * opt.scale;
+	int out_tile = tile_size / opt.scale;
+	int out_w = opt.width / opt.scale;
+	int out_h = opt.height / opt.scale;
+	int columns = (out_w + out_tile - 1) / out_tile;
+	int strips = (out_h + out_tile - 1) / out_tile;
+	
+	frame_request req;
+	req.width = tile_size;
+	req.height = tile_size;
+	req.shader_generation = r.shader_generation;
+	input_sample input;
+	r.update(req, input);
+	r.virtual_size = glm::ivec2(out_w, out_h) * opt.scale;
+	
+	frame_converter converter(export_format::png, tile_size, tile_size, opt.scale);
+	async_readback readback(converter.frame_size, 3);
+	accumulator acc;
+	std::vector<uint8_t> strip(size_t(out_w) * out_tile * 3);
+	std::unique_ptr<png_writer> png;
+	uint64_t hash = 0;
+	
+	// Tiles come back in order, so a strip is complete with its last column
+	auto collect = [&](long tile, const uint8_t *data)
+	{
+		int x = tile % columns * out_tile;
+		int w = std::min(out_tile, out_w - x);
+		int h = std::min(out_tile, out_h - int(tile / columns) * out_tile);
+		for (int y = 0; y < h; y++)
+			std::memcpy(&strip[(size_t(y) * out_w + x) * 3], data + size_t(y) * out_tile * 3, size_t(w) * 3);
+		
+		if (tile % columns == columns - 1)
+		{
+			png->write_rows(strip.data(), h);
+			hash = hash_bytes(strip.data(), size_t(out_w) * h * 3, hash);
+		}
+	};
+	
+	for (long i = first; i < long(opt.frames.size()); i++)
+	{
+		long frame = opt.frames[i];
+		png = std::make_unique<png_writer>(frame_path(opt.output, frame), out_w, out_h, 3);
+		hash = hash_bytes(nullptr, 0);
+		for (long tile = 0; tile < long(columns) * strips; tile++)
+		{
+			if (readback.full())
+				readback.collect(collect);
+			
+			// GL counts rows from the bottom, strips go from the top
+			r.tile_origin = glm::ivec2(tile % columns * tile_size, r.virtual_size.y - (tile / columns + 1) * tile_size);
+			converter.convert(render_frame(r, pacer, acc, req, opt, frame));
+			readback.issue(converter, tile);
+		}
+		
+		while (readback.pending)
+			readback.collect(collect);
+		png->finish();
+		png.reset();
+		manifest.frames[frame] = hash;
+		std::cerr << "Rendered frame " << frame << " in " << columns * strips << " tiles" << std::endl;
+		frame_done(i + 1);
+	}
+}
+
+// Identifies a headless job - a checkpoint of a different one must not be resumed
+uint64_t job_key(const options &opt)
+{
+	std::ostringstream key;
+	key.precision(17);
+	key << opt.width << "x" << opt.height << " " << opt.first_frame << ":" << opt.last_frame << ":" << opt.frame_step << " " << opt.time_step
+		<< " " << format_name(opt.format) << " " << opt.scale << " " << opt.tile_size << " " << opt.samples << " " << opt.shutter << " " << opt.shard << "/" << opt.shard_count << " " << opt.output << "\n";
+	key << slurp_txt(opt.shader_path);
+	for (const auto &path : opt.texture_paths)
+		key << slurp_txt(path);
+	
+	std::string data = key.str();
+	return hash_bytes(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+/*
+	Renders the frame range into an offscreen target and writes every
+	frame to disk. Needs no window system - Mesa's llvmpipe will do.
+	
+	Frames are converted to the output layout on the GPU, read back a
+	few frames behind rendering and written out on worker threads, so
+	the GPU never waits for the CPU unless the encoders fall behind.
+	
+	With a checkpoint, the pipeline is drained and the progress saved
+	every once in a while, and a restarted job skips what's been done.
+*/
+int run_headless(const options &opt)
+{
+	headless_gl gl(opt.diagnostics);
+	
+	std::vector<texture> textures = load_textures(opt.texture_paths);
+	renderer r(opt.shader_path, textures);
+	frame_pacer pacer;
+	input_sample input;
+	
+	frame_request req;
+	req.width = opt.width;
+	req.height = opt.height;
+	req.shader_generation = 1;
+	r.update(req, input);
+	if (!r.program)
+		return 1;
+	
+	// The packed RGB conversion target is three times as wide as the image
+	GLint max_viewport[2], max_texture;
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+	int limit = std::min({max_viewport[0], max_viewport[1], max_texture / 3});
+	
+	// Only PNG output can be rendered in tiles, streams need the whole frame at once
+	if (opt.format != export_format::png && (opt.width > limit || opt.height > limit))
+		throw std::runtime_error(std::to_string(opt.width) + "x"s + std::to_string(opt.height) + " is too large for "s + format_name(opt.format)
+			+ " output on this GPU, the limit is "s + std::to_string(limit) + "x"s + std::to_string(limit));
+	
+	export_manifest manifest;
+	manifest.format = opt.format;
+	manifest.width = opt.width / opt.scale;
+	manifest.height = opt.height / opt.scale;
+	manifest.first_frame = opt.first_frame;
+	manifest.last_frame = opt.last_frame;
+	manifest.frame_step = opt.frame_step;
+	manifest.time_step = opt.time_step;
+	manifest.shard = opt.shard;
+	manifest.shard_count = opt.shard_count;
+	manifest.output = opt.output;
+	
+	checkpoint state;
+	bool resumed = !opt.checkpoint.empty() && state.read(opt.checkpoint);
+	uint64_t key = opt.checkpoint.empty() ? 0 : job_key(opt);
+	if (resumed && state.key != key)
+		throw std::runtime_error("checkpoint '"s + opt.checkpoint + "' belongs to a different shader or settings"s);
+	if (resumed)
+	{
+		manifest.frames = state.hashes;
+		std::cerr << "Resuming from checkpoint at frame " << state.next << " of " << opt.frames.size() << std::endl;
+	}
+	
+	// Called between frames, once all frames before the next one are on disk
+	double checkpoint_time = get_time();
+	auto checkpoint_due = [&](long next)
+	{
+		return !opt.checkpoint.empty() && next < long(opt.frames.size()) && get_time() - checkpoint_time >= opt.checkpoint_interval;
+	};
+	
+	auto save_checkpoint = [&](long next, const std::map<long, uint64_t> &hashes, uint64_t stream_size)
+	{
+		state = checkpoint();
+		state.key = key;
+		state.next = next;
+		state.stream_size = stream_size;
+		state.hashes = hashes;
+		state.write(opt.checkpoint);
+		checkpoint_time = get_time();
+	};
+	
+	long first = resumed ? state.next : 0;
+	if (opt.format == export_format::png && (opt.tile_size > 0 || opt.width > limit || opt.height > limit))
+	{
+		render_tiled(r, pacer, opt, opt.tile_size > 0 ? std::min(opt.tile_size, limit) : std::min(limit, 2048), manifest, first, [&](long next)
+		{
+			if (checkpoint_due(next))
+				save_checkpoint(next, manifest.frames, 0);
+		});
+		
+		if (!opt.manifest.empty())
+			manifest.write(opt.manifest);
+		if (!opt.checkpoint.empty())
+			std::remove(opt.checkpoint.c_str());
+		return 0;
+	}
+	
+	// iTime only depends on the frame number, so shards render exactly what a single process would
+	frame_converter converter(opt.format, opt.width, opt.height, opt.scale);
+	frame_exporter exporter(opt.format, opt.output, converter.width, converter.height, 1.0 / (opt.time_step * opt.frame_step), opt.threads, resumed ? &state : nullptr);
+	async_readback readback(converter.frame_size, 3);
+	accumulator acc;
+	auto collect = [&](long sequence, const uint8_t *data)
+	{
+		frame_exporter::job &j = exporter.acquire();
+		j.sequence = sequence;
+		j.frame = opt.frames[sequence];
+		j.pixels.assign(data, data + readback.frame_size);
+		exporter.submit(j);
+	};
+	
+	double start_time = get_time();
+	for (long i = first; i < long(opt.frames.size()); i++)
+	{
+		if (checkpoint_due(i))
+		{
+			while (readback.pending)
+				readback.collect(collect);
+			uint64_t stream_size = exporter.sync();
+			std::lock_guard<std::mutex> lock(exporter.write_mutex);
+			save_checkpoint(i, exporter.hashes, stream_size);
+		}
+		
+		if (readback.full())
+			readback.collect(collect);
+		
+		converter.convert(render_frame(r, pacer, acc, req, opt, opt.frames[i]));
+		readback.issue(converter, i);
+	}
+	
+	while (readback.pending)
+		readback.collect(collect);
+	exporter.finish();
+	
+	if (!opt.manifest.empty())
+	{
+		if (opt.format != export_format::png)
+		{
+			manifest.header_size = exporter.header_size;
+			manifest.frame_size = converter.frame_size + (opt.format == export_format::y4m ? std::strlen(frame_exporter::frame_tag) : 0);
+		}
+		manifest.frames = exporter.hashes;
+		manifest.write(opt.manifest);
+	}
+	
+	if (!opt.checkpoint.empty())
+		std::remove(opt.checkpoint.c_str());
+	
+	double elapsed = get_time() - start_time;
+	long frames = opt.frames.size() - first;
+	std::cerr << "Exported " << frames << " frames in " << elapsed << " s (" << frames / elapsed << " FPS, "
+		<< frames * opt.samples / elapsed << " sub-frames/s)" << std::endl;
+	return 0;
+}
+
+std::string json_string(const std::string &text)
+{
+	std::string out = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}
+		else
+			out += c;
+	}
+	return out + "\"";
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty()) return 0.0;
+	return sorted[std::min<size_t>(sorted.size() - 1, std::ceil(p / 100.0 * sorted.size()) - (p > 0.0))];
+}
+
+// Min, percentiles and max of a set of times, as a JSON object
+std::string json_percentiles(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	auto percentile = [&](double p){ return ::percentile(values, p); };
+	
+	double mean = 0.0;
+	for (double v : values)
+		mean += v / values.size();
+	
+	std::ostringstream out;
+	out << "{\"min\": " << percentile(0) << ", \"p50\": " << percentile(50) << ", \"p95\": " << percentile(95)
+		<< ", \"p99\": " << percentile(99) << ", \"max\": " << percentile(100) << ", \"mean\": " << mean << "}";
+	return out.str();
+}
+
+// Entries of a JSON array, one per line
+std::string json_list(const std::vector<std::string> &entries)
+{
+	std::string out = "[";
+	for (size_t i = 0; i < entries.size(); i++)
+		out += (i ? ",\n\t\t"s : "\n\t\t"s) + entries[i];
+	return out + "\n\t]";
+}
+
+// Which machine and driver a report comes from, as the first members of a JSON object
+std::string json_machine()
+{
+	char host[256] = "";
+	gethostname(host, sizeof(host) - 1);
+	return "\t\"host\": "s + json_string(host) + ",\n"s
+		+ "\t\"renderer\": "s + json_string(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) + ",\n"s
+		+ "\t\"vendor\": "s + json_string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + ",\n"s
+		+ "\t\"version\": "s + json_string(reinterpret_cast<const char*>(glGetString(GL_VERSION))) + ",\n"s;
+}
+
+struct bench_result
+{
+	std::vector<double> gpu_times;
+	std::vector<double> cpu_times;
+	std::vector<double> frame_times;
+	uint64_t allocations = 0;
+	double seconds = 0.0;
+};
+	
+/*
+	Renders the warmup frames, then measures --bench frames or seconds of
+	them. With wall_clock, the GPU time of a frame is the wall clock time
+	of drawing it with the pipeline drained before and after, instead of
+	a timer query.
+*/
+bench_result bench_frames(renderer &r, frame_pacer &pacer, const frame_request &req, const options &opt, bool wall_clock)
+{
+	bench_result result;
+	gpu_timer timer;
+	input_sample input;
+	double start_time = 0.0, last_time = 0.0;
+	for (long frame = -opt.bench_warmup; ; frame++)
+	{
+		// Warmup frames are not measured
+		if (frame == 0)
+		{
+			glFinish();
+			timer.drain();
+			timer.results.clear();
+			start_time = last_time = get_time();
+		}
+		
+		if (frame >= 0 && (opt.bench_seconds > 0.0 ? last_time - start_time >= opt.bench_seconds : frame >= opt.bench_frames))
+			break;
+		
+		uint64_t frame_allocations = allocation_count;
+		pacer.begin_frame();
+		if (wall_clock)
+			glFinish();
+		double begin_time = get_time();
+		r.frame_counter = frame;
+		if (!wall_clock) timer.begin();
+		r.draw(req, input, frame * opt.time_step, pacer);
+		if (!wall_clock) timer.end();
+		if (wall_clock)
+			glFinish();
+		double draw_time = get_time();
+		pacer.end_frame();
+		if (frame >= 0)
+			result.allocations += allocation_count - frame_allocations;
+		timer.collect();
+		if (wall_clock && frame >= 0)
+			result.gpu_times.push_back((draw_time - begin_time) * 1000.0);
+		
+		double end_time = get_time();
+		if (frame >= 0)
+		{
+			result.cpu_times.push_back((end_time - begin_time) * 1000.0);
+			result.frame_times.push_back((end_time - last_time) * 1000.0);
+		}
+		last_time = end_time;
+	}
+	
+	glFinish();
+	timer.drain();
+	if (!wall_clock)
+		result.gpu_times = std::move(timer.results);
+	result.seconds = last_time - start_time;
+	return result;
+}
+
+/*
+	Benchmarks every combination of the values of the swept controls
+	and prints a CSV row per combination, then the settings on the
+	Pareto front - those where no other setting costs as little or less
+	with every swept control at least as high. Assumes that higher
+	values of the controls mean higher quality.
+*/
+int run_sweep(renderer &r, frame_pacer &pacer, frame_request &req, const options &opt, bool wall_clock)
+{
+	input_sample input;
+	
+	// Swept controls, by their index among the program's controls
+	const std::vector<control_info> &controls = r.info->controls;
+	std::vector<int> swept;
+	for (const auto &range : opt.sweeps)
+	{
+		auto it = std::find_if(controls.begin(), controls.end(), [&](const control_info &ctl){ return ctl.name == range.name || ctl.label == range.name; });
+		if (it == controls.end())
+			throw std::runtime_error("the shader has no control '"s + range.name + "'"s);
+		if (it->type != GL_FLOAT && it->type != GL_INT && it->type != GL_BOOL)
+			throw std::runtime_error("control '"s + range.name + "' is not a scalar and can't be swept"s);
+		swept.push_back(it - controls.begin());
+	}
+	
+	req.program_serial = r.info->serial;
+	std::vector<glm::vec4> initial;
+	for (const auto &ctl : controls)
+		initial.push_back(ctl.initial);
+	
+	struct sweep_point
+	{
+		std::vector<double> values;
+		double gpu_ms;
+		double gpu_p95_ms;
+		double frame_ms;
+	};
+	
+	std::vector<sweep_point> points;
+	for (int i : swept)
+		std::cout << controls[i].name << ",";
+	std::cout << "gpu_ms_p50,gpu_ms_p95,frame_ms_p50" << std::endl;
+	
+	// Every combination, the last range changing fastest
+	std::vector<int> index(opt.sweeps.size(), 0);
+	for (bool done = false; !done;)
+	{
+		trace_scope scope("sweep point");
+		sweep_point point;
+		req.controls = initial;
+		for (size_t k = 0; k < opt.sweeps.size(); k++)
+		{
+			const control_info &ctl = controls[swept[k]];
+			double value = opt.sweeps[k].value(index[k]);
+			if (ctl.type == GL_INT || ctl.type == GL_BOOL)
+				value = std::round(value);
+			req.controls[swept[k]].x = value;
+			point.values.push_back(value);
+		}
+		r.update(req, input);
+		
+		bench_result result = bench_frames(r, pacer, req, opt, wall_clock);
+		std::sort(result.gpu_times.begin(), result.gpu_times.end());
+		std::sort(result.frame_times.begin(), result.frame_times.end());
+		point.gpu_ms = percentile(result.gpu_times, 50);
+		point.gpu_p95_ms = percentile(result.gpu_times, 95);
+		point.frame_ms = percentile(result.frame_times, 50);
+		
+		for (double value : point.values)
+			std::cout << value << ",";
+		std::cout << point.gpu_ms << "," << point.gpu_p95_ms << "," << point.frame_ms << std::endl;
+		points.push_back(point);
+		
+		done = true;
+		for (int k = index.size() - 1; k >= 0 && done; k--)
+		{
+			if (++index[k] < opt.sweeps[k].count)
+				done = false;
+			else
+				index[k] = 0;
+		}
+	}
+	
+	// A point is dominated if another one is no more expensive and no lower anywhere, and better somewhere
+	auto dominates = [](const sweep_point &a, const sweep_point &b)
+	{
+		bool better = a.gpu_ms < b.gpu_ms;
+		for (size_t k = 0; k < a.values.size(); k++)
+		{
+			if (a.values[k] < b.values[k]) return false;
+			better = better || a.values[k] > b.values[k];
+		}
+		return a.gpu_ms <= b.gpu_ms && better;
+	};
+	
+	std::vector<const sweep_point*> front;
+	for (const auto &p : points)
+		if (std::none_of(points.begin(), points.end(), [&](const sweep_point &q){ return dominates(q, p); }))
+			front.push_back(&p);
+	std::sort(front.begin(), front.end(), [](const sweep_point *a, const sweep_point *b){ return a->gpu_ms < b->gpu_ms; });
+	
+	std::cerr << "Pareto front, cheapest first";
+	if (opt.budget_ms > 0.0)
+		std::cerr << " (budget " << opt.budget_ms << " ms at the 95th percentile)";
+	std::cerr << ":" << std::endl;
+	for (const sweep_point *p : front)
+	{
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%8.3f ms (p95 %8.3f ms)", p->gpu_ms, p->gpu_p95_ms);
+		std::cerr << "\t" << buf;
+		for (size_t k = 0; k < p->values.size(); k++)
+			std::cerr << " " << controls[swept[k]].label << "=" << p->values[k];
+		if (opt.budget_ms > 0.0)
+			std::cerr << (p->gpu_p95_ms <= opt.budget_ms ? "" : "  over budget");
+		std::cerr << std::endl;
+	}
+	return 0;
+}
+
+/*
+	Times the shader pass alone - offscreen, so there is no vsync, GUI or
+	swap in the numbers - and prints a JSON report. GPU time comes from
+	timer queries around the pass, CPU time is what the frame took to
+	submit, frame time the wall clock time between frames. With --sweep,
+	the same setup is used to benchmark every combination of controls.
+*/
+int run_bench(const options &opt)
+{
+	headless_gl gl(opt.diagnostics);
+	
+	std::vector<texture> textures = load_textures(opt.texture_paths);
+	renderer r(opt.shader_path, textures);
+	frame_pacer pacer;
+	input_sample input;
+	
+	frame_request req;
+	req.width = opt.width;
+	req.height = opt.height;
+	req.shader_generation = 1;
+	r.update(req, input);
+	if (!r.program)
+		return 1;
+	
+	// Where timer queries miss most of the work, GPU time falls back to the wall clock
+	bool wall_clock = !timer_queries_cover_draws();
+	if (wall_clock)
+		std::cerr << "Timer queries don't cover the work of a draw on this driver, timing draws on the wall clock" << std::endl;
+	
+	if (!opt.sweeps.empty())
+		return run_sweep(r, pacer, req, opt, wall_clock);
+	
+	bench_result result = bench_frames(r, pacer, req, opt, wall_clock);
+	
+	std::cout << "{\n"
+		<< "\t\"shader\": " << json_string(opt.shader_path) << ",\n"
+		<< json_machine()
+		<< "\t\"width\": " << opt.width << ",\n"
+		<< "\t\"height\": " << opt.height << ",\n"
+		<< "\t\"frames\": " << result.frame_times.size() << ",\n"
+		<< "\t\"seconds\": " << result.seconds << ",\n"
+		<< "\t\"gpu_timing\": \"" << (wall_clock ? "wall_clock" : "timer_query") << "\",\n"
+		<< "\t\"gpu_ms\": " << json_percentiles(result.gpu_times) << ",\n"
+		<< "\t\"cpu_ms\": " << json_percentiles(result.cpu_times) << ",\n"
+		<< "\t\"frame_ms\": " << json_percentiles(result.frame_times) << ",\n"
+		<< "\t\"allocations\": " << result.allocations << "\n"
+		<< "}" << std::endl;
+	
+	// Rendering a frame must not touch the heap
+	if (opt.check_allocations && result.allocations > 0)
+	{
+		std::cerr << result.allocations << " heap allocations in " << result.frame_times.size() << " frames" << std::endl;
+		return 2;
+	}
+	return 0;
+}
+
+/*
+	A generated shader with a controlled amount of everything that can
+	make compiling slow. Each function runs a loop nest loop_depth deep,
+	with the body of the innermost loop written out unroll times. Every
+	uniform and sampler is used, so none of them is optimized away.
+*/
+struct synthetic_shader
+{
+	int functions = 1;
+	int loop_depth = 0;
+	int unroll = 1;
+	int uniforms = 0;
+	int samplers = 0;
+	
+	// Every source is different, so the driver's shader cache can't help
+	std::string source() const
+	{
+		static long serial = 0;
+		std::ostringstream s;
+		s << "// synthetic " << getpid() << " " << serial++ << "\n";
+		for (int k = 0; k < uniforms; k++)
+			s << "uniform float u" << k << ";\n";
+		
+		std::string loop_sum = "0";
+		for (int l = 0; l < loop_depth; l++)
+			loop_sum += " + l"s + std::to_string(l);
+		
+		for (int i = 0; i < functions; i++)
+		{
+			s << "float f" << i << "(vec2 p)\n{\n\tfloat v = 0.0;\n";
+			for (int l = 0; l < loop_depth; l++)
+				s << "\tfor (int l" << l << " = 0; l" << l << " < 4; l" << l << "++)\n";
+			s << "\t{\n";
+			for (int j = 0; j < unroll; j++)
+				s << "\t\tv = v * 0.9 + sin(p.x * " << i + j + 1 << ".0 + float(" << loop_sum << ")) * cos(p.y * " << i + 2 * j + 2 << ".0 + v);\n";
+			s << "\t}\n\treturn v;\n}\n";
+		}
+		
+		s << "void mainImage(out vec4 fragColor, in vec2 fragCoord)\n{\n\tvec2 p = fragCoord / iResolution.xy;\n\tfloat v = 0.0;\n";
+		for (int i = 0; i < functions; i++)
+			s << "\tv += f" << i << "(p);\n";
+		for (int k = 0; k < uniforms; k++)
+			s << "\tv += u" << k << ";\n";
+		for (int k = 0; k < samplers; k++)
+			s << "\tv += texture(iChannel" << k << ", p).r;\n";
+		s << "\tfragColor = vec4(v);\n}\n";
+		return s.str();
+	}
+};
+
+// Writes a built-in shader to a file, so it goes through the same make_program() as the user's
+std::unique_ptr<shader_program> make_synthetic_program(const std::string &source, int texture_count, reload_timing *timing = nullptr)
+{
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string path = (tmpdir ? tmpdir : "/tmp") + "/shaderdude-"s + std::to_string(getpid()) + "-synthetic.glsl"s;
+	{
+		std::ofstream f(path);
+		f << source;
+		if (!f) throw std::runtime_error("could not write '"s + path + "'"s);
+	}
+	
+	try
+	{
+		auto program = make_program(path, texture_count, timing);
+		std::remove(path.c_str());
+		return program;
+	}
+	catch (...)
+	{
+		std::remove(path.c_str());
+		throw;
+	}
+}
+
+// Zeroed sd_input for the built-in shaders, which are drawn without a frame_pacer
+struct zero_input_block
+{
+	GLuint buffer;
+	
+	zero_input_block(const zero_input_block &) = delete;
+	zero_input_block &operator=(const zero_input_block &) = delete;
+	
+	zero_input_block()
+	{
+		frame_pacer::block zero = {};
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, sizeof(zero), &zero, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, buffer);
+	}
+	
+	~zero_input_block()
+	{
+		glDeleteBuffers(1, &buffer);
+	}
+};
+
+struct compile_time
+{
+	size_t bytes = 0;
+	double compile_ms = 0.0;
+	double link_ms = 0.0;
+	double first_draw_ms = 0.0;
+};
+
+/*
+	Median time of compiling, of linking and of the first draw of a
+	generated shader. Some drivers (llvmpipe among them) only generate
+	code at the first draw, so that's timed too, as a single pixel drawn
+	with the pipeline drained. Needs a vertex array and a zero_input_block
+	to be bound.
+*/
+compile_time measure_compile(const synthetic_shader &shader, int runs)
+{
+	compile_time result;
+	render_target target(1, 1);
+	std::vector<double> compile_times, link_times, draw_times;
+	for (int run = 0; run < runs; run++)
+	{
+		reload_timing timing;
+		auto prog = make_synthetic_program(shader.source(), shader.samplers, &timing);
+		compile_times.push_back((timing.compiled - timing.read) * 1000.0);
+		link_times.push_back((timing.linked - timing.compiled) * 1000.0);
+		result.bytes = prog->source.size();
+		
+		target.bind();
+		glUseProgram(prog->id);
+		glFinish();
+		double start = get_time();
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glFinish();
+		draw_times.push_back((get_time() - start) * 1000.0);
+	}
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	result.compile_ms = median(compile_times);
+	result.link_ms = median(link_times);
+	result.first_draw_ms = median(draw_times);
+	return result;
+}
+
+/*
+	Time, in ms, of shading every pixel of the target once. Measured on
+	the wall clock around batches of passes with the pipeline drained,
+	as timer queries don't see the rasterization of software renderers.
+*/
+double time_fullscreen(const shader_program &prog, const render_target &target, int passes)
+{
+	target.bind();
+	glUseProgram(prog.id);
+	glUniform3f(prog.location("iResolution"), target.width, target.height, 1.0f);
+	
+	// The first batch is left out, it may include compiling the program for real
+	std::vector<double> times;
+	for (int batch = -1; batch < 5; batch++)
+	{
+		glFinish();
+		double start = get_time();
+		for (int i = 0; i < passes; i++)
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+		glFinish();
+		if (batch >= 0) times.push_back((get_time() - start) * 1000.0 / passes);
+	}
+	return median(times);
+}
+
+/*
+	Measures the basic numbers of the GPU and driver - fill rate, texture
+	fetch bandwidth by format and filter, texture upload bandwidth with
+	and without a PBO, and shader compile and link time by source size -
+	and writes them as a JSON profile to compare machines by. The shaders
+	are built-in, but they go through the same pipeline as the user's.
+*/
+int run_characterize(const options &opt)
+{
+	headless_gl gl(opt.diagnostics);
+	zero_input_block input;
+	
+	GLuint vao;
+	glCreateVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glDisable(GL_DEPTH_TEST);
+	
+	constexpr int passes = 10;
+	std::vector<std::string> fill, fetch, upload, compile;
+	auto entry = [](std::vector<std::string> &list, const std::ostringstream &s){ list.push_back(s.str()); };
+	
+	// Fill rate, with the cheapest shader that still writes every pixel
+	{
+		trace_scope scope("fill rate");
+		auto prog = make_synthetic_program("void mainImage(out vec4 fragColor, in vec2 fragCoord) { fragColor = vec4(fragCoord / iResolution.xy, 0.0, 1.0); }\n", 0);
+		const glm::ivec2 sizes[] = {{640, 360}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+		for (glm::ivec2 size : sizes)
+		{
+			render_target target(size.x, size.y);
+			double ms = time_fullscreen(*prog, target, passes);
+			std::ostringstream s;
+			s << "{\"width\": " << size.x << ", \"height\": " << size.y << ", \"ms\": " << ms
+				<< ", \"mpixels_per_s\": " << size.x * size.y / (ms * 1e3) << "}";
+			entry(fill, s);
+		}
+	}
+	
+	// Arbitrary but fixed texel data
+	constexpr int upload_size = 2048;
+	std::vector<uint8_t> pixels(upload_size * upload_size * 4);
+	for (size_t i = 0; i < pixels.size(); i++)
+		pixels[i] = i * 7 + (i >> 12);
+	
+	// Texture fetch bandwidth - taps spread out, so they aren't all served by one cache line
+	{
+		trace_scope scope("texture fetch");
+		constexpr int taps = 16, size = 1024;
+		auto prog = make_synthetic_program(
+			"void mainImage(out vec4 fragColor, in vec2 fragCoord)"
+			"{"
+			"	vec4 sum = vec4(0.0);"
+			"	for (int i = 0; i < 16; i++)"
+			"		sum += texture(iChannel0, (fragCoord + vec2(i * 67, i * 131)) / iResolution.xy);"
+			"	fragColor = sum / 16.0;"
+			"}\n", 1);
+		render_target target(size, size);
+		
+		struct { const char *name; GLenum format; int bytes; } formats[] = {
+			{"r8", GL_R8, 1}, {"rgba8", GL_RGBA8, 4}, {"rgba16f", GL_RGBA16F, 8}, {"rgba32f", GL_RGBA32F, 16}};
+		struct { const char *name; GLenum filter; } filters[] = {{"nearest", GL_NEAREST}, {"linear", GL_LINEAR}};
+		for (const auto &format : formats)
+		{
+			render_target source(size, size, format.format);
+			glTextureSubImage2D(source.tex, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			glTextureParameteri(source.tex, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTextureParameteri(source.tex, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glBindTextureUnit(0, source.tex);
+			
+			for (const auto &filter : filters)
+			{
+				glTextureParameteri(source.tex, GL_TEXTURE_MIN_FILTER, filter.filter);
+				glTextureParameteri(source.tex, GL_TEXTURE_MAG_FILTER, filter.filter);
+				double ms = time_fullscreen(*prog, target, passes);
+				std::ostringstream s;
+				s << "{\"format\": \"" << format.name << "\", \"filter\": \"" << filter.name << "\", \"ms\": " << ms
+					<< ", \"gb_per_s\": " << double(size) * size * taps * format.bytes / (ms * 1e6) << "}";
+				entry(fetch, s);
+			}
+		}
+		glBindTextureUnit(0, 0);
+	}
+	
+	// Upload bandwidth, until the texture can be used - straight from memory, through a PBO and through a mapped PBO
+	{
+		trace_scope scope("upload");
+		render_target dest(upload_size, upload_size);
+		GLuint pbo[2];
+		glCreateBuffers(2, pbo);
+		glNamedBufferStorage(pbo[0], pixels.size(), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glNamedBufferStorage(pbo[1], pixels.size(), nullptr, flags);
+		void *mapped = glMapNamedBufferRange(pbo[1], 0, pixels.size(), flags);
+		
+		auto time_upload = [&](const char *name, GLuint buffer, auto &&fill_buffer)
+		{
+			std::vector<double> times;
+			for (int i = -2; i < passes; i++)
+			{
+				glFinish();
+				double start = get_time();
+				fill_buffer();
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+				glTextureSubImage2D(dest.tex, 0, 0, 0, upload_size, upload_size, GL_RGBA, GL_UNSIGNED_BYTE, buffer ? nullptr : pixels.data());
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				glFinish();
+				if (i >= 0) times.push_back((get_time() - start) * 1000.0);
+			}
+			
+			double ms = median(times);
+			std::ostringstream s;
+			s << "{\"path\": \"" << name << "\", \"bytes\": " << pixels.size() << ", \"ms\": " << ms
+				<< ", \"gb_per_s\": " << pixels.size() / (ms * 1e6) << "}";
+			entry(upload, s);
+		};
+		
+		time_upload("tex_sub_image", 0, []{});
+		time_upload("pbo", pbo[0], [&]{ glNamedBufferSubData(pbo[0], 0, pixels.size(), pixels.data()); });
+		time_upload("pbo_mapped", pbo[1], [&]{ std::memcpy(mapped, pixels.data(), pixels.size()); });
+		
+		glUnmapNamedBuffer(pbo[1]);
+		glDeleteBuffers(2, pbo);
+	}
+	
+	// Compile and link time by the size of the shader
+	{
+		trace_scope scope("compile");
+		for (int functions : {1, 16, 64, 256})
+		{
+			synthetic_shader shader;
+			shader.functions = functions;
+			compile_time t = measure_compile(shader, 3);
+			std::ostringstream s;
+			s << "{\"functions\": " << functions << ", \"bytes\": " << t.bytes << ", \"compile_ms\": " << t.compile_ms
+				<< ", \"link_ms\": " << t.link_ms << ", \"first_draw_ms\": " << t.first_draw_ms << "}";
+			entry(compile, s);
+		}
+	}
+	
+	glDeleteVertexArrays(1, &vao);
+	
+	std::ostringstream profile;
+	profile << "{\n"
+		<< json_machine()
+		<< "\t\"fill_rate\": " << json_list(fill) << ",\n"
+		<< "\t\"texture_fetch\": " << json_list(fetch) << ",\n"
+		<< "\t\"upload\": " << json_list(upload) << ",\n"
+		<< "\t\"compile\": " << json_list(compile) << "\n"
+		<< "}\n";
+	
+	if (opt.characterize == "-")
+		std::cout << profile.str() << std::flush;
+	else
+	{
+		std::ofstream f(opt.characterize);
+		f << profile.str();
+		if (!f) throw std::runtime_error("could not write '"s + opt.characterize + "'"s);
+		std::cerr << "Wrote machine profile to " << opt.characterize << std::endl;
+	}
+	return 0;
+}
+
+/*
+	Generates shaders that differ from a baseline in one parameter at a
+	time and times compiling, linking and the first draw of each, to find
+	out what compile time grows with on this driver. The exponent of a
+	parameter is the slope of log(compile + link + first draw time) over
+	log(value) - 1 means the time grows linearly, 2 quadratically.
+*/
+int run_compile_scaling(const options &opt)
+{
+	headless_gl gl(opt.diagnostics);
+	zero_input_block input;
+	
+	GLuint vao;
+	glCreateVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	
+	GLint max_samplers;
+	glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_samplers);
+	
+	constexpr int runs = 3;
+	synthetic_shader baseline;
+	baseline.functions = 4;
+	baseline.loop_depth = 1;
+	baseline.unroll = 4;
+	baseline.uniforms = 4;
+	baseline.samplers = 1;
+	
+	struct parameter
+	{
+		const char *name;
+		int synthetic_shader::*field;
+		std::vector<int> values;
+	};
+	
+	const parameter parameters[] = {
+		{"functions", &synthetic_shader::functions, {1, 4, 16, 64, 256}},
+		{"loop_depth", &synthetic_shader::loop_depth, {0, 1, 2, 3, 4}},
+		{"unroll", &synthetic_shader::unroll, {1, 4, 16, 64, 256}},
+		{"uniforms", &synthetic_shader::uniforms, {0, 16, 64, 256, 512}},
+		{"samplers", &synthetic_shader::samplers, {0, 1, 4, 8, 16}},
+	};
+	
+	std::vector<std::string> scaling;
+	for (const parameter &param : parameters)
+	{
+		trace_scope scope("compile scaling");
+		std::vector<std::string> points;
+		std::vector<double> xs, ys;
+		for (int value : param.values)
+		{
+			if (param.field == &synthetic_shader::samplers && value > max_samplers)
+				continue;
+			
+			synthetic_shader shader = baseline;
+			shader.*param.field = value;
+			compile_time t = measure_compile(shader, runs);
+			std::fprintf(stderr, "%-10s %4d: %7zu bytes, compile %8.2f ms, link %8.2f ms, first draw %8.2f ms\n", param.name, value, t.bytes, t.compile_ms, t.link_ms, t.first_draw_ms);
+			
+			if (value > 0)
+			{
+				xs.push_back(std::log(value));
+				ys.push_back(std::log(std::max(t.compile_ms + t.link_ms + t.first_draw_ms, 1e-6)));
+			}
+			
+			std::ostringstream s;
+			s << "{\"value\": " << value << ", \"bytes\": " << t.bytes << ", \"compile_ms\": " << t.compile_ms << ", \"link_ms\": " << t.link_ms
+				<< ", \"first_draw_ms\": " << t.first_draw_ms << "}";
+			points.push_back(s.str());
+		}
+		
+		// Least squares fit of the log-log points
+		double exponent = 0.0;
+		if (xs.size() >= 2)
+		{
+			double mx = std::accumulate(xs.begin(), xs.end(), 0.0) / xs.size();
+			double my = std::accumulate(ys.begin(), ys.end(), 0.0) / ys.size();
+			double sxy = 0.0, sxx = 0.0;
+			for (size_t i = 0; i < xs.size(); i++)
+			{
+				sxy += (xs[i] - mx) * (ys[i] - my);
+				sxx += (xs[i] - mx) * (xs[i] - mx);
+			}
+			exponent = sxx > 0.0 ? sxy / sxx : 0.0;
+		}
+		
+		std::ostringstream s;
+		s << "{\"parameter\": \"" << param.name << "\", \"exponent\": " << exponent << ", \"points\": [\n\t\t\t";
+		for (size_t i = 0; i < points.size(); i++)
+			s << (i ? ",\n\t\t\t" : "") << points[i];
+		s << "\n\t\t]}";
+		scaling.push_back(s.str());
+	}
+	
+	glDeleteVertexArrays(1, &vao);
+	
+	std::ostringstream report;
+	report << "{\n"
+		<< json_machine()
+		<< "\t\"baseline\": {\"functions\": " << baseline.functions << ", \"loop_depth\": " << baseline.loop_depth << ", \"unroll\": " << baseline.unroll
+		<< ", \"uniforms\": " << baseline.uniforms << ", \"samplers\": " << baseline.samplers << "},\n"
+		<< "\t\"runs\": " << runs << ",\n"
+		<< "\t\"scaling\": " << json_list(scaling) << "\n"
+		<< "}\n";
+	
+	if (opt.compile_scaling == "-")
+		std::cout << report.str() << std::flush;
+	else
+	{
+		std::ofstream f(opt.compile_scaling);
+		f << report.str();
+		if (!f) throw std::runtime_error("could not write '"s + opt.compile_scaling + "'"s);
+		std::cerr << "Wrote compile scaling report to " << opt.compile_scaling << std::endl;
+	}
+	return 0;
+}
+
+/*
+	Checks that the shards' manifests together cover every frame of the
+	render exactly once and, for y4m and raw output, joins the shards'
+	streams into the output. The result, including the merged manifest,
+	is byte for byte what a single process would have written.
+*/
+int run_merge(const options &opt)
+{
+	std::vector<export_manifest> shards;
+	for (const auto &path : opt.merge_manifests)
+		shards.push_back(export_manifest::read(path));
+	
+	const export_manifest &base = shards[0];
+	std::vector<bool> have_shard(base.shard_count);
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		if (!shards[i].same_render(base))
+			throw std::runtime_error("'"s + opt.merge_manifests[i] + "' belongs to a different render"s);
+		if (have_shard.at(shards[i].shard))
+			throw std::runtime_error("shard "s + std::to_string(shards[i].shard) + " is given twice"s);
+		have_shard[shards[i].shard] = true;
+	}
+	
+	// Shard and position in its stream of every frame
+	std::map<long, std::pair<int, long>> location;
+	for (int i = 0; i < int(shards.size()); i++)
+	{
+		long position = 0;
+		for (const auto &[frame, hash] : shards[i].frames)
+			if (!location.emplace(frame, std::make_pair(i, position++)).second)
+				throw std::runtime_error("frame "s + std::to_string(frame) + " was rendered twice"s);
+	}
+	
+	long missing = 0, first_missing = 0;
+	for (long frame = base.first_frame; frame <= base.last_frame; frame += base.frame_step)
+		if (!location.count(frame) && !missing++)
+			first_missing = frame;
+	if (missing)
+		throw std::runtime_error(std::to_string(missing) + " frames are missing, the first one is "s + std::to_string(first_missing));
+	
+	export_manifest merged = base;
+	merged.shard = 0;
+	merged.shard_count = 1;
+	merged.frames.clear();
+	
+	if (base.format == export_format::png)
+	{
+		for (const auto &[frame, where] : location)
+		{
+			struct stat st;
+			std::string path = frame_path(shards[where.first].output, frame);
+			if (stat(path.c_str(), &st))
+				throw std::runtime_error("'"s + path + "' is missing"s);
+			merged.frames[frame] = shards[where.first].frames.at(frame);
+		}
+	}
+	else
+	{
+		using file_ptr = std::unique_ptr<FILE, decltype(&std::fclose)>;
+		std::vector<file_ptr> inputs;
+		for (const auto &m : shards)
+		{
+			if (m.output == opt.output)
+				throw std::runtime_error("the merged output would overwrite '"s + m.output + "'"s);
+			inputs.emplace_back(std::fopen(m.output.c_str(), "rb"), &std::fclose);
+			if (!inputs.back())
+				throw std::runtime_error("could not open '"s + m.output + "'"s);
+		}
+		
+		file_ptr output(opt.output == "-" ? stdout : std::fopen(opt.output.c_str(), "wb"), opt.output == "-" ? &std::fflush : &std::fclose);
+		if (!output)
+			throw std::runtime_error("could not open '"s + opt.output + "' for writing"s);
+		merged.output = opt.output;
+		
+		std::vector<uint8_t> buffer(std::max(base.header_size, base.frame_size));
+		size_t tag_size = base.format == export_format::y4m ? std::strlen(frame_exporter::frame_tag) : 0;
+		if (std::fread(buffer.data(), 1, base.header_size, inputs[0].get()) != base.header_size)
+			throw std::runtime_error("'"s + base.output + "' is truncated"s);
+		std::fwrite(buffer.data(), 1, base.header_size, output.get());
+		
+		for (const auto &[frame, where] : location)
+		{
+			const export_manifest &m = shards[where.first];
+			FILE *in = inputs[where.first].get();
+			if (fseeko(in, m.header_size + where.second * m.frame_size, SEEK_SET) || std::fread(buffer.data(), 1, m.frame_size, in) != m.frame_size)
+				throw std::runtime_error("'"s + m.output + "' is truncated"s);
+			
+			uint64_t hash = hash_bytes(buffer.data() + tag_size, m.frame_size - tag_size);
+			if (hash != m.frames.at(frame))
+				throw std::runtime_error("frame "s + std::to_string(frame) + " in '"s + m.output + "' does not match the manifest"s);
+			
+			std::fwrite(buffer.data(), 1, m.frame_size, output.get());
+			merged.frames[frame] = hash;
+		}
+		
+		if (std::ferror(output.get()))
+			throw std::runtime_error("writing '"s + opt.output + "' failed"s);
 	}
-};
-
-struct shader_uniform
-{
-	std::string name;
-	GLint location;
-	GLenum type;
 	
-	shader_uniform() :
-		location(-1)
-	{}
+	if (!opt.manifest.empty())
+		merged.write(opt.manifest);
 	
-	shader_uniform(const std::string &n, GLint l, GLenum t) :
-		name(n),
-		location(l),
-		type(t)
-	{}
-};
+	std::cerr << "All " << merged.frames.size() << " frames from " << shards.size() << " shards are complete" << std::endl;
+	return 0;
+}
 
-struct shader_program
+// Graphs of every series in the profile and a histogram of frame times
+void profiler_window(const frame_profile &profile)
 {
-	GLuint id;
-	std::map<std::string, shader_uniform> uniforms;
+	static const struct
+	{
+		const char *label;
+		profile_series frame_profile::*series;
+		const char *unit;
+	} rows[] = {
+		{"GPU shader pass", &frame_profile::gpu_pass, "ms"},
+		{"GPU present", &frame_profile::gpu_present, "ms"},
+		{"GPU GUI render", &frame_profile::gpu_gui, "ms"},
+		{"GPU swap", &frame_profile::gpu_swap, "ms"},
+		{"GPU frame", &frame_profile::gpu_frame, "ms"},
+		{"CPU uniform upload", &frame_profile::cpu_uniforms, "ms"},
+		{"CPU draw", &frame_profile::cpu_draw, "ms"},
+		{"CPU swap", &frame_profile::cpu_swap, "ms"},
+		{"CPU render frame", &frame_profile::cpu_frame, "ms"},
+		{"CPU poll", &frame_profile::cpu_poll, "ms"},
+		{"CPU GUI build", &frame_profile::cpu_gui, "ms"},
+		{"CPU file watcher", &frame_profile::cpu_watcher, "ms"},
+		{"Render thread allocations", &frame_profile::render_allocations, "/frame"},
+		{"Main thread allocations", &frame_profile::main_allocations, "/frame"},
+	};
 	
-	shader_program(const shader_program &) = delete;
-	shader_program &operator=(const shader_program &) = delete;
+	float values[profile_series::size];
+	char overlay[64];
+	ImGui::Begin("Profiler");
 	
-	explicit shader_program(GLuint i) :
-		id(i)
+	for (const auto &row : rows)
 	{
-		GLint count;
-		glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
-		
-		for (int loc = 0; loc < count; loc++)
+		int n = (profile.*row.series).read(values);
+		float avg = 0.0f, max = 0.0f;
+		for (int i = 0; i < n; i++)
 		{
-			char buf[256];
-			GLsizei length;
-			GLint size;
-			GLenum type;
-			glGetActiveUniform(id, loc, sizeof(buf), &length, &size, &type, buf);
-			uniforms[buf] = shader_uniform(buf, loc, type);
+			avg += values[i] / n;
+			max = std::max(max, values[i]);
 		}
+		
+		std::snprintf(overlay, sizeof(overlay), "avg %.3f %s, max %.3f %s", avg, row.unit, max, row.unit);
+		ImGui::PlotLines(row.label, values, n, 0, overlay, 0.0f, max * 1.2f + 0.001f, ImVec2(0.0f, 40.0f));
 	}
 	
-	~shader_program()
-	{
-		glDeleteProgram(id);
-	}
-};
-
-bool gui_visible = true;
+	// Stutters show up as a second hump
+	constexpr int bins = 32;
+	float histogram[bins] = {};
+	int n = profile.cpu_frame.read(values);
+	float max = 0.0f;
+	for (int i = 0; i < n; i++)
+		max = std::max(max, values[i]);
+	
+	// Nothing to bin before the first frame or while all of them are 0 ms
+	if (max > 0.0f)
+		for (int i = 0; i < n; i++)
+			histogram[std::min(int(values[i] / max * bins), bins - 1)]++;
+	
+	std::snprintf(overlay, sizeof(overlay), "0 - %.1f ms", max);
+	ImGui::PlotHistogram("Frame times", histogram, bins, 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 80.0f));
+	ImGui::End();
+}
 
-std::string slurp_txt(const std::string &path)
+void glfw_error_callback(int error, const char *message)
 {
-	std::ifstream f(path);
-	if (!f) throw std::runtime_error("could not read file '"s + path + "'"s);
-	std::stringstream buf;
-	buf << f.rdbuf();
-	return buf.str();
+	throw std::runtime_error("GLFW error - "s + message);
 }
 
-GLuint get_shader_log(GLuint id, std::string &log)
+// Called on exit when tracing from the start
+void write_trace()
 {
-	GLint result, length;
-	glGetShaderiv(id, GL_COMPILE_STATUS, &result);
-	glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
-
-	if ( length > 0 )
+	try
 	{
-		char *buf = new char[length + 1];
-		glGetShaderInfoLog(id, length, NULL, buf);
-		log = std::string(buf);
-		delete[] buf;
+		trace.write();
 	}
-	else
+	catch (const std::exception &ex)
 	{
-		log = "";
+		std::cerr << ex.what() << std::endl;
 	}
-
-	return result;
 }
 
-GLuint create_shader(GLenum type, const std::string &source)
+// The first press starts tracing, the following ones write out what's been recorded
+void toggle_trace()
 {
-	GLuint shader = glCreateShader(type);
-	char *buf = new char[source.length() + 1];
-	std::strncpy(buf, source.c_str(), source.length() + 1);
-	glShaderSource(shader, 1, &buf, NULL);
-	glCompileShader(shader);
-	delete[] buf;
-	
-	std::string log;
-	if (get_shader_log(shader, log) == GL_FALSE)
+	if (!trace.enabled)
 	{
-		glDeleteShader(shader);
-		throw std::runtime_error("Shader compilation failed:\n"s + log + "\n"s);
+		trace.start();
+		std::cerr << "Tracing started, press F2 again to write '" << trace.path << "'" << std::endl;
+		return;
 	}
 	
-	return shader;
-}
-
-GLuint create_vertex_shader()
-{
-	static const std::string source = 
-	"#version 430 core\n"
-
-	"out VS_OUT"
-	"{"
-	"	vec2 uv;"
-	"} vs_out;"
-
-	"const vec2 vertices[6] = vec2[6]("
-	"	vec2(-1, -1),"
-	"	vec2(1, -1),"
-	"	vec2(-1, 1),"
-	"	vec2(-1, 1),"
-	"	vec2(1, -1),"
-	"	vec2(1, 1)"
-	");"
-
-	"void main()"
-	"{"
-	"	vec2 vertex = vertices[gl_VertexID];"
-	"	gl_Position = vec4(vertex.xy, 0, 1);"
-	"	vs_out.uv = vertex * 0.5 + 0.5;"
-	"}";
-	
-	return create_shader(GL_VERTEX_SHADER, source);
+	try
+	{
+		trace.write();
+		std::cerr << "Trace written to '" << trace.path << "'" << std::endl;
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
 }
 
-GLuint load_fragment_shader(const std::string &path, int texture_count)
+void glfw_key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
-	static const std::string prefix = 
-	"#version 430 core\n"
-	
-	"in VS_OUT"
-	"{"
-	"	vec2 uv;"
-	"} vs_out;"
-	
-	"uniform float iTime;"
-	"uniform vec3 iResolution;"
-	"uniform vec4 iMouse;"
-	"uniform int iFrame;"
-	"out vec4 f_color;"
-	"\n";
-	
-	static const std::string suffix = 
-	"\n"
-	"void main()"
-	"{"
-	"	vec2 fragCoord = vs_out.uv * iResolution.xy;"
-	"	vec4 fragColor;"
-	"	mainImage(fragColor, fragCoord);"
-	"	f_color = fragColor;"
-	"}"
-	"\n";
-	
-	std::stringstream texture_bindings;
-	for (int i = 0; i < texture_count; i++)
-		texture_bindings << "layout (binding = " << i << ") uniform sampler2D iChannel" << i << ";\n";
-	if (texture_count)
-		texture_bindings << "uniform vec3 iChannelResolution[" << texture_count << "];\n";
-	
-	std::string shader_source = prefix + texture_bindings.str() + slurp_txt(path) + suffix;
-	return create_shader(GL_FRAGMENT_SHADER, shader_source);
+	if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+		gui_visible = !gui_visible;
+	else if (key == GLFW_KEY_F2 && action == GLFW_PRESS)
+		toggle_trace();
 }
 
-std::unique_ptr<shader_program> make_program(const std::string &path, int texture_count)
+// Mouse input is published as soon as it arrives and the render thread is woken up
+void publish_input(GLFWwindow *window)
 {
-	GLuint vsh = 0, fsh = 0;
-	
-	try
-	{
-		vsh = create_vertex_shader();
-		fsh = load_fragment_shader(path, texture_count);
-	}
-	catch (...)
-	{
-		glDeleteShader(vsh);
-		glDeleteShader(fsh);
-		std::rethrow_exception(std::current_exception());
-	}
-	
-	GLuint prog = glCreateProgram();
-	glAttachShader(prog, vsh);
-	glAttachShader(prog, fsh);
-	glLinkProgram(prog);
-	glDeleteShader(vsh);
-	glDeleteShader(fsh);
+	auto link = static_cast<render_link*>(glfwGetWindowUserPointer(window));
+	if (!link) return;
 	
-	return std::make_unique<shader_program>(prog);
+	link->input.time = get_time();
+	link->inputs.write_buffer() = link->input;
+	link->inputs.publish();
+	link->wake.notify();
 }
 
-time_t get_mod_time(const std::string &path)
+// The cursor is reported in window coordinates, fragCoord is in framebuffer pixels - they differ on HiDPI displays
+glm::vec2 cursor_to_framebuffer(GLFWwindow *window, double x, double y)
 {
-	struct stat result;
-	if (stat(path.c_str(), &result) == 0)
-		return result.st_mtime;
-	else
-		throw std::runtime_error("could not get modification time");
+	int window_width, window_height, fb_width, fb_height;
+	glfwGetWindowSize(window, &window_width, &window_height);
+	glfwGetFramebufferSize(window, &fb_width, &fb_height);
+	if (window_width <= 0 || window_height <= 0)
+		return glm::vec2(x, y);
+	return glm::vec2(x * fb_width / window_width, y * fb_height / window_height);
 }
 
-void glfw_error_callback(int error, const char *message)
+void glfw_cursor_pos_callback(GLFWwindow *window, double x, double y)
 {
-	throw std::runtime_error("GLFW error - "s + message);
+	auto link = static_cast<render_link*>(glfwGetWindowUserPointer(window));
+	if (!link) return;
+	
+	glm::vec2 pos = cursor_to_framebuffer(window, x, y);
+	link->input.mouse.x = pos.x;
+	link->input.mouse.y = pos.y;
+	publish_input(window);
 }
 
-void glfw_key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+void glfw_mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 {
-	if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
-		gui_visible = !gui_visible;
+	auto link = static_cast<render_link*>(glfwGetWindowUserPointer(window));
+	if (!link) return;
+	
+	if (button == GLFW_MOUSE_BUTTON_LEFT)
+		link->input.mouse.z = action == GLFW_PRESS;
+	else if (button == GLFW_MOUSE_BUTTON_RIGHT)
+		link->input.mouse.w = action == GLFW_PRESS;
+	publish_input(window);
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc < 2)
+	options opt;
+	try
+	{
+		opt = parse_options(argc, argv);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << ex.what() << std::endl;
+		std::cerr << "Usage: " << argv[0] << " [--headless] [--size WxH] [--frames FIRST:LAST:STEP] [--fps FPS | --time-step SECONDS] [--output PATTERN] [--format png|y4m|raw|nv12] [--scale N] [--samples N] [--shutter DEGREES] [--tile SIZE] [--threads N] [--shard INDEX/COUNT] [--manifest PATH] [--checkpoint PATH] [--checkpoint-interval SECONDS] [--trace PATH] [--diagnostics] FILENAME [TEXTURES]" << std::endl;
+		std::cerr << "       " << argv[0] << " --bench FRAMES|SECONDSs [--warmup FRAMES] [--check-allocations] [--size WxH] [--trace PATH] [--diagnostics] FILENAME [TEXTURES]" << std::endl;
+		std::cerr << "       " << argv[0] << " --bench FRAMES|SECONDSs --sweep NAME=FIRST:LAST:COUNT... [--budget MS] [--warmup FRAMES] [--size WxH] [--diagnostics] FILENAME [TEXTURES]" << std::endl;
+		std::cerr << "       " << argv[0] << " --characterize PATH [--diagnostics]" << std::endl;
+		std::cerr << "       " << argv[0] << " --compile-scaling PATH [--diagnostics]" << std::endl;
+		std::cerr << "       " << argv[0] << " --merge [--output PATH] [--manifest PATH] MANIFESTS" << std::endl;
 		return 1;
+	}
+	
+	trace.name_thread("main");
+	if (!opt.trace.empty())
+	{
+		trace.path = opt.trace;
+		trace.start();
+		std::atexit(write_trace);
+	}
+	
+	if (opt.merge)
+	{
+		try
+		{
+			return run_merge(opt);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Merging failed: " << ex.what() << std::endl;
+			return 1;
+		}
+	}
+	
+	if (!opt.characterize.empty())
+	{
+		try
+		{
+			return run_characterize(opt);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Characterization failed: " << ex.what() << std::endl;
+			return 1;
+		}
+	}
+	
+	if (!opt.compile_scaling.empty())
+	{
+		try
+		{
+			return run_compile_scaling(opt);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Compile scaling benchmark failed: " << ex.what() << std::endl;
+			return 1;
+		}
+	}
+	
+	if (opt.bench)
+	{
+		try
+		{
+			return run_bench(opt);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Benchmark failed: " << ex.what() << std::endl;
+			return 1;
+		}
+	}
+	
+	if (opt.headless)
+	{
+		try
+		{
+			return run_headless(opt);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Headless rendering failed: " << ex.what() << std::endl;
+			return 1;
+		}
+	}
 	
-	const std::string shader_path = argv[1];
+	const std::string &shader_path = opt.shader_path;
 	
 	glfwSetErrorCallback(glfw_error_callback);
 	glfwInit();
 	glfwWindowHint(GLFW_SAMPLES, 2);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	
+	// Validation costs driver time, so it's only asked for when diagnosing
+	if (opt.diagnostics)
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	else
+		glfwWindowHint(GLFW_CONTEXT_NO_ERROR, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	
@@ -315,9 +4610,13 @@ int main(int argc, char *argv[])
 	glfwMakeContextCurrent(win);
 	glewExperimental = GL_TRUE;
 	if (glewInit() != GLEW_OK) throw std::runtime_error("glewInit() failed");
+	if (opt.diagnostics)
+		enable_gl_diagnostics();
 	
 	// GLFW callbacks - these must be set up before ImGui takes control
 	glfwSetKeyCallback(win, glfw_key_callback);
+	glfwSetCursorPosCallback(win, glfw_cursor_pos_callback);
+	glfwSetMouseButtonCallback(win, glfw_mouse_button_callback);
 	
 	// Imgui context
 	IMGUI_CHECKVERSION();
@@ -329,17 +4628,14 @@ int main(int argc, char *argv[])
 	
 	// Load textures
 	std::vector<texture> textures;
-	for (int i = 0; i < argc - 2; i++)
+	try
 	{
-		try
-		{
-			textures.emplace_back(std::string(argv[2 + i]));
-		}
-		catch (const std::exception &ex)
-		{
-			std::cerr << "Loading textures failed: " << ex.what() << std::endl;
-			return 1;
-		}
+		textures = load_textures(opt.texture_paths);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Loading textures failed: " << ex.what() << std::endl;
+		return 1;
 	}
 	
 	// Check shader file
@@ -353,25 +4649,32 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 	
-	// VAO
-	GLuint vao;
-	glCreateVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	
-	// Bind textures to samplers
-	for (int i = 0; i < textures.size(); i++)
-		glBindTextureUnit(i, textures[i].tex);
+	// The GUI backend creates its GL objects here, before the context is handed over
+	ImGui_ImplOpenGL3_NewFrame();
+	glfwMakeContextCurrent(nullptr);
 	
-	glDisable(GL_DEPTH_TEST);
-	
-	// The shader
-	std::unique_ptr<shader_program> program;
+	render_link link;
+	double cursor_x, cursor_y;
+	glfwGetCursorPos(win, &cursor_x, &cursor_y);
+	glm::vec2 cursor = cursor_to_framebuffer(win, cursor_x, cursor_y);
+	link.input.mouse = glm::vec4(cursor.x, cursor.y, 0.0f, 0.0f);
+	link.inputs.write_buffer() = link.input;
+	link.inputs.publish();
+	glfwSetWindowUserPointer(win, &link);
+	std::thread render(render_thread, win, std::ref(link), std::cref(shader_path), std::cref(textures));
 	
 	// Some state
-	int win_w = 0, win_h = 0;
-	time_t shader_mod_time = 0;
-	double shader_start_time = 0.0;
-	long frame_counter = 0;
+	double shader_mod_time = 0.0;
+	double shader_saved = 0.0;
+	double shader_detected = 0.0;
+	long shader_generation = 0;
+	int interleave_index = 0;
+	int preview_index = 2;
+	int frames_in_flight = 2;
+	bool show_profiler = false;
+	bool show_heatmap = false;
+	int heatmap_columns = 16;
+	shader_cost_tracker costs;
 	std::map<std::string, int> int_uniforms_state;
 	std::map<std::string, float> float_uniforms_state;
 	std::map<std::string, bool> bool_uniforms_state;
@@ -380,167 +4683,242 @@ int main(int argc, char *argv[])
 	
 	while (!glfwWindowShouldClose(win))
 	{
-		// Time
-		double t = glfwGetTime();
-		
-		// Mouse
-		double mx, my;
-		bool mlb = glfwGetMouseButton(win, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
-		bool mrb = glfwGetMouseButton(win, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
-		glfwGetCursorPos(win, &mx, &my);
-		
-		// Poll events
-		glfwPollEvents();
+		uint64_t frame_allocations = allocation_count;
+		// Animated shaders are kept going by the render thread - the GUI only follows events
+		link.status.update();
+		const render_status &status = link.status.read_buffer();
+		const program_info *info = status.program.get();
+		costs.update(status.program);
+		double poll_start = get_time();
+		glfwWaitEventsTimeout(info && info->inputs.animated() ? 1.0 / 60.0 : 0.1);
+		double poll_end = get_time();
+		link.profile.cpu_poll.push((poll_end - poll_start) * 1000.0);
+		trace.record("poll", poll_start, poll_end - poll_start);
 		
 		// Imgui new frame
-		ImGui_ImplOpenGL3_NewFrame();
+		double gui_start = get_time();
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
 		
 		// GUI
+		bool interacting = false;
 		if (gui_visible)
 		{
 			ImGui::Begin("Controls");
-			ImGui::Text("Average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+			ImGui::Text("Average %.3f ms/frame (%.1f FPS)", status.frame_ms, status.frame_ms > 0.0f ? 1000.0f / status.frame_ms : 0.0f);
+			ImGui::Combo("Shading", &interleave_index, "Every pixel\0Checkerboard (1/2)\0Interleaved 2x2 (1/4)\0");
+			ImGui::Combo("Editing preview", &preview_index, "Full resolution\0Half resolution\0Quarter resolution\0");
+			ImGui::SliderInt("Frames in flight", &frames_in_flight, 1, frame_pacer::max_frames_in_flight);
+			ImGui::Text("Input latency %.1f ms (max %.1f ms), latched after %.1f ms", status.latency_ms, status.latency_max_ms, status.latch_ms);
+			if (status.comparing)
+				ImGui::Text("Comparing with the previous version...");
+			else if (status.comparison.valid)
+				ImGui::Text("New version: %+.1f%% (p50), 95%% CI %+.1f%% .. %+.1f%%, %.3f -> %.3f ms", status.comparison.change, status.comparison.low, status.comparison.high, status.comparison.baseline_ms, status.comparison.new_ms);
+			if (status.relative_timing && (status.comparison.valid || show_heatmap))
+				ImGui::TextDisabled("This driver's timer queries miss most of the work, GPU times are only relative");
+			ImGui::Checkbox("Profiler", &show_profiler);
+			ImGui::Checkbox("Cost heatmap", &show_heatmap);
+			if (show_heatmap)
+			{
+				ImGui::SliderInt("Heatmap columns", &heatmap_columns, 2, 64);
+				ImGui::Text("Slowest tile %.3f ms, all tiles %.3f ms", status.heatmap_max_ms, status.heatmap_total_ms);
+			}
+			
+			// Driver warnings, only collected with --diagnostics
+			if (opt.diagnostics && ImGui::CollapsingHeader("GL diagnostics"))
+			{
+				std::lock_guard<std::mutex> lock(debug_log.mutex);
+				for (const auto &e : debug_log.entries)
+					ImGui::TextWrapped("%ldx %s: %s", e.count, gl_debug_log::type_name(e.type), e.message.c_str());
+				if (debug_log.dropped)
+					ImGui::Text("%ld more messages dropped", debug_log.dropped);
+				if (debug_log.entries.empty())
+					ImGui::Text("No messages");
+			}
+			
+			// Edit-to-photon latency of the latest reloads, newest first
+			if (ImGui::CollapsingHeader("Reload latency"))
+			{
+				float totals[render_status::reload_history];
+				char line[160];
+				for (int i = 0; i < status.reload_count; i++)
+					totals[i] = status.reloads[i].total() * 1000.0;
+				if (status.reload_count > 1)
+					ImGui::PlotHistogram("Total (ms)", totals, status.reload_count, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+				for (int i = status.reload_count - 1; i >= 0; i--)
+				{
+					status.reloads[i].format(line, sizeof(line));
+					ImGui::TextUnformatted(line);
+				}
+			}
+			
+			// SPIR-V metrics, with the change since the previous version of the shader
+			if (ImGui::CollapsingHeader("Static cost"))
+			{
+				if (ImGui::Checkbox("Optimize with spirv-opt", &costs.optimize))
+					costs.refresh();
+				
+				const shader_cost &cost = costs.current, &previous = costs.previous;
+				auto metric = [&](const char *label, int shader_cost::*field)
+				{
+					if (previous.valid)
+						ImGui::Text("%s: %d (%+d)", label, cost.*field, cost.*field - previous.*field);
+					else
+						ImGui::Text("%s: %d", label, cost.*field);
+				};
+				
+				if (!cost.error.empty())
+					ImGui::TextWrapped("%s", cost.error.c_str());
+				else if (!cost.valid)
+					ImGui::Text("Analyzing...");
+				else
+				{
+					metric("Instructions", &shader_cost::instructions);
+					metric("Functions", &shader_cost::functions);
+					metric("Calls", &shader_cost::calls);
+					metric("Loops", &shader_cost::loops);
+					metric("Branches", &shader_cost::branches);
+					metric("Texture samples", &shader_cost::texture_samples);
+					metric("Live values (estimate)", &shader_cost::live_values);
+				}
+			}
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 			ImGui::Separator();
 			ImGui::Dummy(ImVec2(0.0f, 5.0f));
 			ImGui::TextWrapped("This section allows you to control uniforms with names beginning with 'ctl_'");
 			ImGui::Dummy(ImVec2(0.0f, 10.0f));
 			
-			if (program)
-				for (const auto &[name, unif] : program->uniforms)
+			if (info)
+				for (const auto &ctl : info->controls)
 				{
-					if (name.find("ctl_") != 0) continue;
-					std::string ctl_name = name.substr(4);
-					
-					switch (unif.type)
+					switch (ctl.type)
 					{
 						case GL_INT:
-							ImGui::InputInt(ctl_name.c_str(), &int_uniforms_state[name]);
+							ImGui::InputInt(ctl.label.c_str(), &int_uniforms_state.try_emplace(ctl.name, ctl.initial.x).first->second);
 							break;
 						
 						case GL_FLOAT:
-							ImGui::SliderFloat(ctl_name.c_str(), &float_uniforms_state[name], 0.0f, 1.0f);
+							ImGui::SliderFloat(ctl.label.c_str(), &float_uniforms_state.try_emplace(ctl.name, ctl.initial.x).first->second, 0.0f, 1.0f);
 							break;
 							
 						case GL_BOOL:
-							ImGui::Checkbox(ctl_name.c_str(), &bool_uniforms_state[name]);
+							ImGui::Checkbox(ctl.label.c_str(), &bool_uniforms_state.try_emplace(ctl.name, ctl.initial.x != 0.0f).first->second);
 							break;
 							
 						case GL_FLOAT_VEC3:
-							ImGui::ColorEdit3(ctl_name.c_str(), &vec3_uniforms_state[name][0]);
+							ImGui::ColorEdit3(ctl.label.c_str(), &vec3_uniforms_state.try_emplace(ctl.name, ctl.initial.x, ctl.initial.y, ctl.initial.z).first->second[0]);
 							break;
 							
 						case GL_FLOAT_VEC4:
-							ImGui::ColorEdit4(ctl_name.c_str(), &vec4_uniforms_state[name][0]);
+							ImGui::ColorEdit4(ctl.label.c_str(), &vec4_uniforms_state.try_emplace(ctl.name, ctl.initial).first->second[0]);
 							break;
 					}
+					
+					interacting |= ImGui::IsItemActive();
 				}
 			
 			ImGui::End();
+			
+			if (show_profiler)
+				profiler_window(link.profile);
 		}
 		
-		// Resolution
-		static int win_w = 0, win_h = 0;
-		static time_t shader_mod_time = 0;
-		static double shader_start_time = 0.0;
+		// Dragging in the shader view counts as editing too
+		if (info && info->inputs.mouse && ImGui::IsMouseDragging(0) && !imgui_io.WantCaptureMouse)
+			interacting = true;
 		
-		if (frame_counter % 5 == 0)
+		// Check the shader file - the render thread reloads when the generation changes
+		double watcher_start = get_time();
+		try
 		{
-			int new_win_w, new_win_h;
-			glfwGetWindowSize(win, &new_win_w, &new_win_h);
-			if (new_win_h != win_h || new_win_w != win_w)
-			{
-				win_w = new_win_w;
-				win_h = new_win_h;
-				glViewport(0, 0, win_w, win_h);
-			}
-		
-			try
+			double new_shader_mod_time = get_mod_time(shader_path);
+			if (new_shader_mod_time != shader_mod_time)
 			{
-				int new_shader_mod_time = get_mod_time(shader_path);
-				if (new_shader_mod_time != shader_mod_time)
-				{
-					try
-					{
-						shader_mod_time = new_shader_mod_time;
-						program = make_program(shader_path, textures.size());
-						glUseProgram(program->id);
-						
-						// std::cerr << "Successfully loaded the new shader!" << std::endl;
-						// for (const auto &[k, v] : program->uniforms)
-						// 	std::cerr << "\t- " << k << std::endl;
-					}
-					catch (const std::exception &ex)
-					{
-						std::cerr << "Loading shader failed!" << std::endl;
-						std::cerr << ex.what() << std::endl;
-					}
-					
-					shader_start_time = glfwGetTime();
-				}
-			}
-			catch (const std::exception &ex)
-			{
-				// Ignore file access errors
+				// The save happened this long ago on the wall clock
+				double age = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count() - new_shader_mod_time;
+				shader_detected = get_time();
+				shader_saved = age >= 0.0 && age < 10.0 ? shader_detected - age : 0.0;
+				shader_mod_time = new_shader_mod_time;
+				shader_generation++;
 			}
 		}
+		catch (const std::exception &ex)
+		{
+			// Ignore file access errors
+		}
+		double watcher_end = get_time();
+		link.profile.cpu_watcher.push((watcher_end - watcher_start) * 1000.0);
+		trace.record("file watcher", watcher_start, watcher_end - watcher_start);
 		
-		glClear(GL_COLOR_BUFFER_BIT);
+		ImGui::Render();
+		double gui_end = get_time();
+		link.profile.cpu_gui.push((gui_end - gui_start - (watcher_end - watcher_start)) * 1000.0);
+		trace.record("GUI build", gui_start, gui_end - gui_start);
 		
-		// Draw shader
-		if (program)
-		{
-			glUniform1f(program->uniforms["iTime"].location, t - shader_start_time);
-			glUniform3f(program->uniforms["iResolution"].location, win_w, win_h, 0);
-			glUniform4f(program->uniforms["iMouse"].location, mx, my, mlb, mrb);
-			glUniform1i(program->uniforms["iFrame"].location, frame_counter);
-			
-			for (const auto &[name, unif] : program->uniforms)
+		// Hand the frame over to the render thread
+		frame_request &req = link.requests.write_buffer();
+		glfwGetFramebufferSize(win, &req.width, &req.height);
+		req.shader_generation = shader_generation;
+		req.shader_saved = shader_saved;
+		req.shader_detected = shader_detected;
+		req.program_serial = info ? info->serial : 0;
+		req.mode = static_cast<interleave_mode>(interleave_index);
+		req.preview_downscale = 1 << preview_index;
+		req.interacting = interacting;
+		req.frames_in_flight = frames_in_flight;
+		req.heatmap_columns = show_heatmap ? heatmap_columns : 0;
+		
+		req.controls.clear();
+		if (info)
+			for (const auto &ctl : info->controls)
 			{
-				switch (unif.type)
+				glm::vec4 value(0.0f);
+				switch (ctl.type)
 				{
 					case GL_INT:
-						if (auto it = int_uniforms_state.find(name); it != int_uniforms_state.end())
-							glUniform1i(unif.location, it->second);
+						value.x = int_uniforms_state.try_emplace(ctl.name, ctl.initial.x).first->second;
 						break;
 						
 					case GL_FLOAT:
-						if (auto it = float_uniforms_state.find(name); it != float_uniforms_state.end())
-							glUniform1f(unif.location, it->second);
+						value.x = float_uniforms_state.try_emplace(ctl.name, ctl.initial.x).first->second;
 						break;
 					
 					case GL_BOOL:
-						if (auto it = bool_uniforms_state.find(name); it != bool_uniforms_state.end())
-							glUniform1i(unif.location, it->second);
+						value.x = bool_uniforms_state.try_emplace(ctl.name, ctl.initial.x != 0.0f).first->second;
 						break;
 					
 					case GL_FLOAT_VEC3:
-						if (auto it = vec3_uniforms_state.find(name); it != vec3_uniforms_state.end())
-							glUniform3fv(unif.location, 1, &it->second[0]);
+					{
+						const glm::vec3 &v = vec3_uniforms_state.try_emplace(ctl.name, ctl.initial.x, ctl.initial.y, ctl.initial.z).first->second;
+						value = glm::vec4(v.x, v.y, v.z, 0.0f);
 						break;
+					}
 						
 					case GL_FLOAT_VEC4:
-						if (auto it = vec4_uniforms_state.find(name); it != vec4_uniforms_state.end())
-							glUniform4fv(unif.location, 1, &it->second[0]);
+						value = vec4_uniforms_state.try_emplace(ctl.name, ctl.initial).first->second;
 						break;
 				}
+				req.controls.push_back(value);
 			}
 			
-			for (int i = 0; i < textures.size(); i++)
-				glUniform3f(program->uniforms["iChannelResolution["s + std::to_string(i) +"]"s].location, textures[i].width, textures[i].height, 0.f);
-			
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+		{
+			trace_scope scope("publish request");
+			req.gui.copy(*ImGui::GetDrawData());
 		}
-		
-		// Draw GUI
-		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-		
-		glfwSwapBuffers(win);
-		frame_counter++;
+		link.requests.publish();
+		link.wake.notify();
+		link.profile.main_allocations.push(allocation_count - frame_allocations);
 	}
+			
+	// Stop rendering and take the context back
+	link.quit = true;
+	link.wake.notify();
+	render.join();
+	
+	// Tracing started with F2 is written out too
+	if (trace.enabled && opt.trace.empty())
+		write_trace();
+	glfwMakeContextCurrent(win);
 	
 	// ImGui cleanup
 	ImGui_ImplOpenGL3_Shutdown();
@@ -549,8 +4927,6 @@ int main(int argc, char *argv[])
 	
 	// Cleanup
 	textures.clear();
-	program.reset();
-	glDeleteVertexArrays(1, &vao);
 	glfwTerminate();
 	
 	return 0;
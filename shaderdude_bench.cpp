@@ -0,0 +1,309 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "shaderdude_core.hpp"
+
+using namespace std::string_literals;
+
+/*
+	Microbenchmarks of the CPU side of shaderdude. No GL context is
+	created - the few GL entry points the measured code calls are pointed
+	at a mock, so only shaderdude's own work is timed. Each benchmark runs
+	a fixed number of iterations per sample after a warmup sample, and the
+	minimum and median of the samples are the figures worth comparing.
+*/
+
+// Mock GL - a program with a fixed list of active uniforms and calls that do nothing
+namespace mock
+{
+	struct uniform
+	{
+		std::string name;
+		GLint size;
+		GLenum type;
+	};
+
+	std::vector<uniform> uniforms;
+	long calls = 0;
+
+	void GLAPIENTRY get_programiv(GLuint program, GLenum pname, GLint *params)
+	{
+		*params = pname == GL_ACTIVE_UNIFORMS ? uniforms.size() : 0;
+	}
+
+	void GLAPIENTRY get_active_uniform(GLuint program, GLuint index, GLsizei buf_size, GLsizei *length, GLint *size, GLenum *type, GLchar *name)
+	{
+		const uniform &u = uniforms[index];
+		*length = std::min<GLsizei>(u.name.size(), buf_size - 1);
+		std::memcpy(name, u.name.c_str(), *length);
+		name[*length] = '\0';
+		*size = u.size;
+		*type = u.type;
+	}
+
+	GLint GLAPIENTRY get_uniform_location(GLuint program, const GLchar *name)
+	{
+		return calls++ & 0xff;
+	}
+
+	void GLAPIENTRY uniform1i(GLint location, GLint v0) { calls++; }
+	void GLAPIENTRY uniform1f(GLint location, GLfloat v0) { calls++; }
+	void GLAPIENTRY uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) { calls++; }
+	void GLAPIENTRY uniform3fv(GLint location, GLsizei count, const GLfloat *value) { calls++; }
+	void GLAPIENTRY uniform4fv(GLint location, GLsizei count, const GLfloat *value) { calls++; }
+	void GLAPIENTRY bind_texture_unit(GLuint unit, GLuint texture) { calls++; }
+	void GLAPIENTRY delete_program(GLuint program) { calls++; }
+	void GLAPIENTRY create_textures(GLenum target, GLsizei n, GLuint *textures) { std::fill(textures, textures + n, 1); }
+	void GLAPIENTRY texture_storage_2d(GLuint texture, GLsizei levels, GLenum format, GLsizei width, GLsizei height) { calls++; }
+	void GLAPIENTRY texture_sub_image_2d(GLuint texture, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) { calls++; }
+	void GLAPIENTRY texture_parameteri(GLuint texture, GLenum pname, GLint param) { calls++; }
+	void GLAPIENTRY delete_textures(GLsizei n, const GLuint *textures) { calls++; }
+
+	// GLEW's entry points are function pointers, so they can simply be redirected
+	void install()
+	{
+		glGetProgramiv = get_programiv;
+		glGetActiveUniform = get_active_uniform;
+		glGetUniformLocation = get_uniform_location;
+		glUniform1i = uniform1i;
+		glUniform1f = uniform1f;
+		glUniform3f = uniform3f;
+		glUniform3fv = uniform3fv;
+		glUniform4fv = uniform4fv;
+		glBindTextureUnit = bind_texture_unit;
+		glDeleteProgram = delete_program;
+		glCreateTextures = create_textures;
+		glTextureStorage2D = texture_storage_2d;
+		glTextureSubImage2D = texture_sub_image_2d;
+		glTextureParameteri = texture_parameteri;
+		glDeleteTextures = delete_textures;
+	}
+}
+
+struct bench_result
+{
+	std::string name;
+	long iterations;
+	std::vector<double> samples;
+};
+
+struct bench_runner
+{
+	int sample_count = 15;
+	std::string filter;
+	std::vector<bench_result> results;
+
+	// Inputs of benchmarks that are filtered out aren't worth building
+	bool wants(const std::string &name) const
+	{
+		return filter.empty() || name.find(filter) != std::string::npos;
+	}
+
+	// Time per iteration, in ns, of every sample
+	template <typename F>
+	void run(const std::string &name, long iterations, F &&f)
+	{
+		if (!wants(name))
+			return;
+
+		bench_result result{name, iterations, {}};
+		for (int s = -1; s < sample_count; s++)
+		{
+			double start = get_time();
+			for (long i = 0; i < iterations; i++)
+				f();
+			double elapsed = get_time() - start;
+
+			// The first sample only warms up caches and the allocator
+			if (s >= 0)
+				result.samples.push_back(elapsed * 1e9 / iterations);
+		}
+
+		std::cerr << name << ": " << *std::min_element(result.samples.begin(), result.samples.end()) << " ns" << std::endl;
+		results.push_back(std::move(result));
+	}
+
+	void write_json(std::ostream &out) const
+	{
+		out << "{\n\t\"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			std::vector<double> v = results[i].samples;
+			std::sort(v.begin(), v.end());
+			double mean = 0.0, variance = 0.0;
+			for (double x : v) mean += x / v.size();
+			for (double x : v) variance += (x - mean) * (x - mean) / v.size();
+
+			out << "\t\t{\"name\": \"" << results[i].name << "\", \"iterations\": " << results[i].iterations
+				<< ", \"samples\": " << v.size() << ", \"min_ns\": " << v.front() << ", \"median_ns\": " << v[v.size() / 2]
+				<< ", \"mean_ns\": " << mean << ", \"stddev_ns\": " << std::sqrt(variance) << ", \"max_ns\": " << v.back() << "}"
+				<< (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "\t]\n}" << std::endl;
+	}
+};
+
+// Keeps the compiler from optimizing the measured work away
+volatile size_t sink;
+
+// Deterministic file contents, so every run measures the same thing
+std::string write_file(const std::string &path, size_t size)
+{
+	std::string line = "\tcol += 0.5 + 0.5 * cos(iTime + uv.xyx + vec3(0, 2, 4)); // padding\n";
+	std::string data;
+	data.reserve(size);
+	while (data.size() < size)
+		data += line;
+	data.resize(size);
+
+	std::ofstream f(path, std::ios::binary);
+	f << data;
+	if (!f) throw std::runtime_error("could not write '"s + path + "'"s);
+	return path;
+}
+
+// A small binary PPM, which stb_image reads
+std::string write_image(const std::string &path, int width, int height)
+{
+	std::ofstream f(path, std::ios::binary);
+	f << "P6\n" << width << " " << height << "\n255\n";
+	for (int i = 0; i < width * height * 3; i++)
+		f.put(char(i * 7));
+	if (!f) throw std::runtime_error("could not write '"s + path + "'"s);
+	return path;
+}
+
+int main(int argc, char *argv[])
+{
+	bench_runner runner;
+	std::string output;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--samples" && i + 1 < argc)
+			runner.sample_count = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--filter" && i + 1 < argc)
+			runner.filter = argv[++i];
+		else if (arg == "--output" && i + 1 < argc)
+			output = argv[++i];
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--samples N] [--filter NAME] [--output FILE]" << std::endl;
+			return 1;
+		}
+	}
+
+	mock::install();
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string base = (tmpdir ? tmpdir : "/tmp") + "/shaderdude-bench-"s + std::to_string(getpid());
+	std::vector<std::string> files;
+
+	try
+	{
+		// Source composition, with a typical shader and four channels
+		if (runner.wants("compose_fragment_source"))
+		{
+			files.push_back(write_file(base + "-shader.glsl", 16 << 10));
+			runner.run("compose_fragment_source", 2000, [&]
+			{
+				sink = compose_fragment_source(files.back(), 4).size();
+			});
+		}
+
+		// Vertical flip of a 4096x4096 RGBA image
+		if (runner.wants("flip_rows"))
+		{
+			std::vector<uint8_t> image(4096 * 4096 * 4);
+			runner.run("flip_rows", 10, [&]
+			{
+				flip_rows(image.data(), 4096 * 4, 4096);
+				sink = image[0];
+			});
+		}
+
+		// Introspection of a program with many controls and an array
+		for (int i = 0; i < 64; i++)
+			mock::uniforms.push_back({"ctl_parameter_"s + std::to_string(i), 1, GLenum(i % 2 ? GL_FLOAT : GL_FLOAT_VEC3)});
+		mock::uniforms.push_back({"iChannelResolution[0]", 4, GL_FLOAT_VEC3});
+		mock::uniforms.push_back({"iResolution", 1, GL_FLOAT_VEC3});
+		mock::uniforms.push_back({"iFrame", 1, GL_INT});
+		runner.run("shader_program", 2000, [&]
+		{
+			shader_program prog(1);
+			sink = prog.uniforms.size();
+		});
+
+		// Per-frame uniform dispatch for the same program
+		if (runner.wants("dispatch_uniforms"))
+		{
+			shader_program prog(1);
+			std::vector<control_info> controls;
+			std::vector<glm::vec4> values;
+			for (const auto &[name, unif] : prog.uniforms)
+				if (name.find("ctl_") == 0)
+				{
+					controls.push_back({name, name.substr(4), unif.location, unif.type, glm::vec4(0.0f)});
+					values.push_back(glm::vec4(0.5f));
+				}
+
+			files.push_back(write_image(base + "-image.ppm", 16, 16));
+			std::vector<texture> textures;
+			for (int i = 0; i < 4; i++)
+				textures.emplace_back(files.back());
+
+			runner.run("dispatch_uniforms", 100000, [&]
+			{
+				dispatch_uniforms(prog, controls, values, textures, glm::ivec2(1920, 1080), 0);
+			});
+		}
+
+		// Reading large files
+		if (runner.wants("slurp_txt_1m"))
+		{
+			files.push_back(write_file(base + "-1m.txt", 1 << 20));
+			runner.run("slurp_txt_1m", 50, [&]
+			{
+				sink = slurp_txt(files.back()).size();
+			});
+		}
+
+		if (runner.wants("slurp_txt_64m"))
+		{
+			files.push_back(write_file(base + "-64m.txt", 64 << 20));
+			runner.run("slurp_txt_64m", 2, [&]
+			{
+				sink = slurp_txt(files.back()).size();
+			});
+		}
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "Benchmark failed: " << ex.what() << std::endl;
+		for (const auto &path : files)
+			std::remove(path.c_str());
+		return 1;
+	}
+
+	for (const auto &path : files)
+		std::remove(path.c_str());
+
+	if (output.empty())
+		runner.write_json(std::cout);
+	else
+	{
+		std::ofstream f(output);
+		runner.write_json(f);
+	}
+	return 0;
+}
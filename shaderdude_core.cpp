@@ -0,0 +1,239 @@
+#include "shaderdude_core.hpp"
+
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std::string_literals;
+
+tracer trace;
+
+// Writes everything recorded so far - recording goes on
+void tracer::write()
+{
+	std::ofstream f(path);
+	if (!f) throw std::runtime_error("could not write trace '"s + path + "'"s);
+	
+	f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	f << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << gpu_track << ",\"args\":{\"name\":\"GPU\"}}";
+	
+	std::lock_guard<std::mutex> lock(mutex);
+	f.precision(3);
+	f << std::fixed;
+	for (const auto &buffer : buffers)
+	{
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		f << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->track << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+		for (const event &e : buffer->events)
+			f << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.track
+				<< ",\"ts\":" << (e.start - start_time) * 1e6 << ",\"dur\":" << e.duration * 1e6 << "}";
+	}
+	
+	f << "\n]}\n";
+	if (!f) throw std::runtime_error("could not write trace '"s + path + "'"s);
+}
+
+texture::texture(const std::string &path)
+{
+	trace_scope scope("load texture");
+	data = stbi_load(path.c_str(), &width, &height, &channels, 0);
+	if (!data)
+		throw std::runtime_error("failed to load image '"s + path + "'"s);
+	
+	flip_rows(data, width * channels, height);
+	
+	GLenum data_format;
+	if (channels == 1) data_format = GL_RED;
+	else if (channels == 2) data_format = GL_RG;
+	else if (channels == 3) data_format = GL_RGB;
+	else data_format = GL_RGBA;
+	
+	glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+	glTextureStorage2D(tex, 1, GL_RGBA8, width, height);
+	glTextureSubImage2D(tex, 0, 0, 0, width, height, data_format, GL_UNSIGNED_BYTE, data);
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+texture::~texture()
+{
+	if (tex) glDeleteTextures(1, &tex);
+	if (data) stbi_image_free(data);
+}
+
+void flip_rows(uint8_t *data, int row_size, int height)
+{
+	for (int y = 0; y < height / 2; y++)
+		std::swap_ranges(data + y * row_size, data + (y + 1) * row_size, data + (height - 1 - y) * row_size);
+}
+
+shader_program::shader_program(GLuint i) :
+	id(i)
+{
+	GLint count;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+	
+	for (int index = 0; index < count; index++)
+	{
+		char buf[256];
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(id, index, sizeof(buf), &length, &size, &type, buf);
+		uniforms[buf] = shader_uniform(buf, glGetUniformLocation(id, buf), type);
+		
+		// Arrays are reported once, as 'name[0]'
+		std::string name(buf, length);
+		if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			for (int i = 1; i < size; i++)
+			{
+				std::string element = name.substr(0, name.size() - 2) + std::to_string(i) + "]";
+				uniforms[element] = shader_uniform(element, glGetUniformLocation(id, element.c_str()), type);
+			}
+	}
+	
+	for (GLint loc; (loc = location("iChannelResolution["s + std::to_string(channel_resolution.size()) + "]"s)) >= 0;)
+		channel_resolution.push_back(loc);
+}
+
+std::string slurp_txt(const std::string &path)
+{
+	trace_scope scope("slurp_txt");
+	std::ifstream f(path);
+	if (!f) throw std::runtime_error("could not read file '"s + path + "'"s);
+	std::stringstream buf;
+	buf << f.rdbuf();
+	return buf.str();
+}
+
+GLuint get_shader_log(GLuint id, std::string &log)
+{
+	GLint result, length;
+	glGetShaderiv(id, GL_COMPILE_STATUS, &result);
+	glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
+
+	if ( length > 0 )
+	{
+		char *buf = new char[length + 1];
+		glGetShaderInfoLog(id, length, NULL, buf);
+		log = std::string(buf);
+		delete[] buf;
+	}
+	else
+	{
+		log = "";
+	}
+
+	return result;
+}
+
+GLuint create_shader(GLenum type, const std::string &source)
+{
+	trace_scope scope("compile shader");
+	GLuint shader = glCreateShader(type);
+	char *buf = new char[source.length() + 1];
+	std::strncpy(buf, source.c_str(), source.length() + 1);
+	glShaderSource(shader, 1, &buf, NULL);
+	glCompileShader(shader);
+	delete[] buf;
+	
+	std::string log;
+	if (get_shader_log(shader, log) == GL_FALSE)
+	{
+		glDeleteShader(shader);
+		throw std::runtime_error("Shader compilation failed:\n"s + log + "\n"s);
+	}
+	
+	return shader;
+}
+
+// The user's shader wrapped in everything shaderdude provides
+std::string compose_fragment_source(const std::string &path, int texture_count)
+{
+	static const std::string prefix = 
+	"#version 430 core\n"
+	
+	"in VS_OUT"
+	"{"
+	"	vec2 uv;"
+	"} vs_out;"
+	
+	"layout (std140, binding = 0) uniform sd_input"
+	"{"
+	"	vec4 iMouse;"
+	"	float iTime;"
+	"};"
+	"uniform vec3 iResolution;"
+	"uniform int iFrame;"
+	"out vec4 f_color;"
+	"\n";
+	
+	// sd_stride, sd_offset and sd_row_shift map the pixels actually being
+	// shaded onto fragCoord, so a pass can cover only a subset of the image
+	static const std::string suffix = 
+	"\n"
+	"uniform vec2 sd_stride = vec2(1.0);"
+	"uniform vec2 sd_offset = vec2(0.5);"
+	"uniform int sd_row_shift = -1;"
+	
+	"void main()"
+	"{"
+	"	vec2 cell = floor(gl_FragCoord.xy);"
+	"	vec2 fragCoord = cell * sd_stride + sd_offset;"
+	"	if (sd_row_shift >= 0) fragCoord.x += mod(cell.y + float(sd_row_shift), 2.0);"
+	"	vec4 fragColor;"
+	"	mainImage(fragColor, fragCoord);"
+	"	f_color = fragColor;"
+	"}"
+	"\n";
+	
+	std::stringstream texture_bindings;
+	for (int i = 0; i < texture_count; i++)
+		texture_bindings << "layout (binding = " << i << ") uniform sampler2D iChannel" << i << ";\n";
+	if (texture_count)
+		texture_bindings << "uniform vec3 iChannelResolution[" << texture_count << "];\n";
+	
+	return prefix + texture_bindings.str() + slurp_txt(path) + suffix;
+}
+
+void dispatch_uniforms(const shader_program &prog, const std::vector<control_info> &controls, const std::vector<glm::vec4> &values, const std::vector<texture> &textures, glm::ivec2 resolution, int frame)
+{
+	glUniform3f(prog.location("iResolution"), resolution.x, resolution.y, 0);
+	glUniform1i(prog.location("iFrame"), frame);
+	
+	for (int i = 0; i < values.size(); i++)
+	{
+		const control_info &ctl = controls[i];
+		switch (ctl.type)
+		{
+			case GL_INT:
+			case GL_BOOL:
+				glUniform1i(ctl.location, values[i].x);
+				break;
+			
+			case GL_FLOAT:
+				glUniform1f(ctl.location, values[i].x);
+				break;
+			
+			case GL_FLOAT_VEC3:
+				glUniform3fv(ctl.location, 1, &values[i][0]);
+				break;
+			
+			case GL_FLOAT_VEC4:
+				glUniform4fv(ctl.location, 1, &values[i][0]);
+				break;
+		}
+	}
+	
+	for (int i = 0; i < textures.size(); i++)
+	{
+		if (i < prog.channel_resolution.size())
+			glUniform3f(prog.channel_resolution[i], textures[i].width, textures[i].height, 0.f);
+		glBindTextureUnit(i, textures[i].tex);
+	}
+}
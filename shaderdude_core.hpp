@@ -0,0 +1,218 @@
+// The parts of shaderdude that don't need a window, shared with the benchmarks
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+// Seconds on a monotonic clock - unlike glfwGetTime() it works without GLFW
+inline double get_time()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+	Records spans in the Chrome trace event format, viewable in
+	chrome://tracing or ui.perfetto.dev. Each thread appends to its own
+	buffer, so the only lock taken while recording is never contended
+	except when the trace is being written out. When tracing is off,
+	recording costs a relaxed atomic load.
+*/
+struct tracer
+{
+	// Spans of GPU work are put on their own track
+	static constexpr int gpu_track = 0;
+	
+	struct event
+	{
+		const char *name;
+		double start;
+		double duration;
+		int track;
+	};
+	
+	struct thread_buffer
+	{
+		std::mutex mutex;
+		std::vector<event> events;
+		std::string name;
+		int track;
+	};
+	
+	std::atomic<bool> enabled{false};
+	std::string path = "shaderdude.trace.json";
+	double start_time = 0.0;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<thread_buffer>> buffers;
+	
+	// Buffers outlive their threads, so nothing recorded is lost
+	thread_buffer &local()
+	{
+		thread_local thread_buffer *buffer = nullptr;
+		if (!buffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.push_back(std::make_unique<thread_buffer>());
+			buffer = buffers.back().get();
+			buffer->track = buffers.size();
+			buffer->name = "thread " + std::to_string(buffer->track);
+			buffer->events.reserve(4096);
+		}
+		return *buffer;
+	}
+	
+	void start()
+	{
+		start_time = get_time();
+		enabled = true;
+	}
+	
+	void name_thread(const std::string &name)
+	{
+		thread_buffer &buffer = local();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.name = name;
+	}
+	
+	// Name must be a string literal
+	void record(const char *name, double start, double duration, int track = -1)
+	{
+		if (!enabled.load(std::memory_order_relaxed)) return;
+		
+		thread_buffer &buffer = local();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.events.push_back({name, start, duration, track < 0 ? buffer.track : track});
+	}
+	
+	// Writes everything recorded so far - recording goes on
+	void write();
+};
+
+extern tracer trace;
+
+// Records the time until the end of the enclosing scope
+struct trace_scope
+{
+	const char *name;
+	double start = 0.0;
+	bool active;
+	
+	trace_scope(const trace_scope &) = delete;
+	trace_scope &operator=(const trace_scope &) = delete;
+	
+	explicit trace_scope(const char *n) :
+		name(n),
+		active(trace.enabled.load(std::memory_order_relaxed))
+	{
+		if (active) start = get_time();
+	}
+	
+	~trace_scope()
+	{
+		if (active) trace.record(name, start, get_time() - start);
+	}
+};
+
+struct texture 
+{
+	std::string filename;
+	GLuint tex;
+	uint8_t *data;
+	int width;
+	int height;
+	int channels;
+	
+	texture(const texture&) = delete;
+	texture &operator=(const texture&) = delete;
+	
+	texture(texture &&src) :
+		filename(std::move(src.filename)),
+		tex(src.tex),
+		data(src.data),
+		width(src.width),
+		height(src.height),
+		channels(src.channels)
+	{
+		src.tex = 0;
+		src.data = nullptr;
+	}
+	
+	explicit texture(const std::string &path);
+	~texture();
+};
+
+// Images are stored top row first, GL wants the bottom row first
+void flip_rows(uint8_t *data, int row_size, int height);
+
+struct shader_uniform
+{
+	std::string name;
+	GLint location;
+	GLenum type;
+	
+	shader_uniform() :
+		location(-1)
+	{}
+	
+	shader_uniform(const std::string &n, GLint l, GLenum t) :
+		name(n),
+		location(l),
+		type(t)
+	{}
+};
+
+struct shader_program
+{
+	GLuint id;
+	std::map<std::string, shader_uniform, std::less<>> uniforms;
+	
+	// Looked up once, so drawing doesn't have to build the names
+	std::vector<GLint> channel_resolution;
+	
+	// Complete fragment shader source, empty for internal programs
+	std::string source;
+	
+	shader_program(const shader_program &) = delete;
+	shader_program &operator=(const shader_program &) = delete;
+	
+	explicit shader_program(GLuint i);
+	
+	~shader_program()
+	{
+		glDeleteProgram(id);
+	}
+	
+	// Takes any string type, a lookup never allocates
+	GLint location(std::string_view name) const
+	{
+		auto it = uniforms.find(name);
+		return it != uniforms.end() ? it->second.location : -1;
+	}
+};
+
+// ctl_ uniform exposed in the GUI
+struct control_info
+{
+	std::string name;
+	std::string label;
+	GLint location;
+	GLenum type;
+	glm::vec4 initial;
+};
+
+std::string slurp_txt(const std::string &path);
+GLuint get_shader_log(GLuint id, std::string &log);
+GLuint create_shader(GLenum type, const std::string &source);
+std::string compose_fragment_source(const std::string &path, int texture_count);
+
+// Sets the per-frame uniforms of the program, which must be in use, and binds the textures
+void dispatch_uniforms(const shader_program &prog, const std::vector<control_info> &controls, const std::vector<glm::vec4> &values, const std::vector<texture> &textures, glm::ivec2 resolution, int frame);